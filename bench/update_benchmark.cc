@@ -0,0 +1,140 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+// Benchmarks of the work done for every update before any network call:
+// parsing a getUpdates response, slicing entities out of the text, matching
+// commands and formatting the /run_cpp reply. fixtures/get_updates.json is a
+// response of 40 updates in a mix of ASCII and CJK text with emoji.
+
+#include "dispatch.h"
+#include <benchmark/benchmark.h>
+#include <fstream>
+#include <sstream>
+#include <spdlog/spdlog.h>
+
+namespace {
+std::string read_fixture(const std::string &name) {
+    std::ifstream file(std::string(OHMYARCH_FIXTURES_DIR) + '/' + name);
+    if (!file)
+        throw std::runtime_error("can't open fixture " + name);
+
+    std::ostringstream content;
+    content << file.rdbuf();
+
+    return content.str();
+}
+
+const std::string &get_updates_body() {
+    static const std::string body = read_fixture("get_updates.json");
+
+    return body;
+}
+
+ohmyarch::update_batch parse_fixture() {
+    std::int32_t max_update_id = -1;
+    auto batch = ohmyarch::parse_updates(get_updates_body(), max_update_id);
+    if (!batch)
+        throw std::runtime_error("get_updates.json has no commands");
+
+    return std::move(batch.value());
+}
+
+void parse_updates(benchmark::State &state) {
+    const std::string &body = get_updates_body();
+
+    for (auto _ : state) {
+        std::int32_t max_update_id = -1;
+        auto batch = ohmyarch::parse_updates(body, max_update_id);
+        benchmark::DoNotOptimize(batch);
+    }
+
+    state.SetBytesProcessed(state.iterations() * body.size());
+}
+BENCHMARK(parse_updates);
+
+// Every entity of every message, the way dispatch walks them.
+void slice_entities(benchmark::State &state) {
+    const auto batch = parse_fixture();
+
+    std::size_t entities = 0;
+
+    for (auto _ : state) {
+        for (const auto &update : batch) {
+            const auto &message = update.message()
+                                      ? update.message().value()
+                                      : update.edited_message().value();
+            ohmyarch::utf16_cursor cursor(message.text());
+
+            for (const auto &entity : message.entities()) {
+                auto slice = cursor.slice(entity.offset(), entity.length());
+                benchmark::DoNotOptimize(slice);
+                ++entities;
+            }
+        }
+    }
+
+    state.SetItemsProcessed(entities);
+}
+BENCHMARK(slice_entities);
+
+void find_command(benchmark::State &state) {
+    const ohmyarch::command_registry commands("ohmyarch_bot");
+    const boost::string_view texts[] = {
+        "/quote",           "/joke@ohmyarch_bot", "/run_cpp",
+        "/unknown_command", "/about@other_bot",   "/girl_pics"};
+
+    for (auto _ : state)
+        for (const auto text : texts) {
+            auto command = commands.find(text);
+            benchmark::DoNotOptimize(command);
+        }
+
+    state.SetItemsProcessed(state.iterations() *
+                            (sizeof(texts) / sizeof(texts[0])));
+}
+BENCHMARK(find_command);
+
+// Everything dispatch does short of queueing the commands.
+void collect_commands(benchmark::State &state) {
+    const auto batch = parse_fixture();
+    const ohmyarch::command_registry commands("ohmyarch_bot");
+    ohmyarch::run_cpp_jobs jobs(4096);
+
+    for (auto _ : state) {
+        auto result = ohmyarch::collect_commands(commands, jobs, batch);
+        benchmark::DoNotOptimize(result);
+    }
+
+    state.SetItemsProcessed(state.iterations() * batch.size());
+}
+BENCHMARK(collect_commands);
+
+// Output of state.range(0) lines of 40 characters.
+void format_run_cpp_output(benchmark::State &state) {
+    std::string output;
+    for (std::int64_t line = 0; line < state.range(0); ++line)
+        output += "0123456789 abcdefghijklmnopqrstuvwxyz\n";
+
+    for (auto _ : state) {
+        auto text = ohmyarch::format_run_cpp_output(output);
+        benchmark::DoNotOptimize(text);
+    }
+
+    state.SetBytesProcessed(state.iterations() * output.size());
+}
+BENCHMARK(format_run_cpp_output)->Arg(1)->Arg(16)->Arg(256);
+}
+
+int main(int argc, char *argv[]) {
+    // Parse errors are logged.
+    spdlog::stdout_logger_mt("logger");
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+
+    benchmark::RunSpecifiedBenchmarks();
+}
@@ -0,0 +1,55 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#pragma once
+
+#include "offset_store.h"
+#include "webhook.h"
+#include <memory>
+#include <string>
+
+namespace ohmyarch {
+// One of the bots the process serves. A bot has its own token, getUpdates
+// offset and flood limits; the HTTP clients, the send scheduler, the executor
+// and the content caches are shared by all of them.
+class bot {
+  public:
+    struct options {
+        std::string token;
+        // Empty keeps the offset in memory only, see offset_store.h.
+        std::string update_offset_path;
+        // Updates are pushed to a webhook instead of polled if listen_uri is
+        // set, see webhook.h. webhook_url is what Telegram is told to post
+        // to; if it is empty the registration is left alone.
+        ohmyarch::webhook::options webhook;
+        std::string webhook_url;
+    };
+
+    // index tells the bots apart in the shared send scheduler and executor.
+    bot(std::size_t index, const options &options);
+
+    bot(const bot &) = delete;
+    bot &operator=(const bot &) = delete;
+
+    std::size_t index() const { return index_; }
+    const options &settings() const { return options_; }
+
+    // The path of a Bot API method relative to telegram_uri. Every bot's
+    // calls go through the same client that way.
+    std::string method(const std::string &name) const { return path_ + name; }
+
+    // The offset of the next getUpdates call, or -1 before the first update.
+    std::int32_t update_offset() const { return update_offset_; }
+    void advance_update_offset(std::int32_t offset);
+
+  private:
+    const std::size_t index_;
+    const options options_;
+    const std::string path_;
+    std::int32_t update_offset_ = -1;
+    std::unique_ptr<offset_store> offsets_;
+};
+}
@@ -0,0 +1,40 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#pragma once
+
+#include <boost/utility/string_view.hpp>
+#include <cpprest/http_msg.h>
+#include <string>
+
+namespace ohmyarch {
+// Writes the JSON body of a Bot API call straight into one buffer, reserved
+// up front from size_hint, and turns it into a POST request for the method.
+class bot_request {
+  public:
+    explicit bot_request(std::size_t size_hint = 0);
+
+    bot_request &field(boost::string_view name, std::int64_t value);
+    bot_request &field(boost::string_view name, boost::string_view value);
+
+    // Arrays of strings or objects, e.g. allowed_updates or the media of
+    // sendMediaGroup.
+    bot_request &begin_array(boost::string_view name);
+    bot_request &element(boost::string_view value);
+    bot_request &begin_object();
+    bot_request &end_object();
+    bot_request &end_array();
+
+    // Closes the body and moves it into the request.
+    web::http::http_request to_http_request(const std::string &method);
+
+  private:
+    void separate();
+    void write_string(boost::string_view value);
+
+    std::string body_;
+};
+}
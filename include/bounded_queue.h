@@ -0,0 +1,111 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <experimental/optional>
+#include <functional>
+#include <mutex>
+
+namespace ohmyarch {
+// What a full bounded_queue does with one more element.
+enum class overload_policy : std::uint8_t {
+    drop_oldest, // evict the front element to make room
+    drop_newest, // reject the new element
+    // reject the new element if an equal one is already queued, even when the
+    // queue isn't full; otherwise behave like drop_newest
+    collapse_duplicates
+};
+
+// Counters shared by any number of queues.
+struct queue_statistics {
+    std::atomic<std::uint64_t> enqueued{0};
+    std::atomic<std::uint64_t> dropped{0};
+    std::atomic<std::uint64_t> collapsed{0};
+    std::atomic<std::size_t> high_water{0};
+};
+
+// A mutex-protected FIFO with a fixed capacity, safe for any number of
+// producers and consumers.
+template <typename T, typename Equal = std::equal_to<T>> class bounded_queue {
+  public:
+    bounded_queue(std::size_t capacity, overload_policy policy,
+                  queue_statistics &statistics)
+        : capacity_(std::max<std::size_t>(capacity, 1)), policy_(policy),
+          statistics_(statistics) {}
+
+    // Returns false if value was dropped or collapsed into a queued element.
+    bool push(T value) {
+        std::lock_guard<std::mutex> guard(mutex_);
+
+        if (policy_ == overload_policy::collapse_duplicates &&
+            std::find_if(elements_.begin(), elements_.end(),
+                         [this, &value](const T &element) {
+                             return equal_(element, value);
+                         }) != elements_.end()) {
+            ++statistics_.collapsed;
+
+            return false;
+        }
+
+        if (elements_.size() >= capacity_) {
+            ++statistics_.dropped;
+
+            if (policy_ != overload_policy::drop_oldest)
+                return false;
+
+            elements_.pop_front();
+        }
+
+        elements_.emplace_back(std::move(value));
+        ++statistics_.enqueued;
+
+        std::size_t high_water = statistics_.high_water;
+        while (elements_.size() > high_water &&
+               !statistics_.high_water.compare_exchange_weak(
+                   high_water, elements_.size())) {
+        }
+
+        return true;
+    }
+
+    std::experimental::optional<T> pop() {
+        std::lock_guard<std::mutex> guard(mutex_);
+
+        if (elements_.empty())
+            return {};
+
+        std::experimental::optional<T> value(std::move(elements_.front()));
+        elements_.pop_front();
+
+        return value;
+    }
+
+    bool empty() const {
+        std::lock_guard<std::mutex> guard(mutex_);
+
+        return elements_.empty();
+    }
+
+    std::size_t size() const {
+        std::lock_guard<std::mutex> guard(mutex_);
+
+        return elements_.size();
+    }
+
+  private:
+    const std::size_t capacity_;
+    const overload_policy policy_;
+    queue_statistics &statistics_;
+    Equal equal_;
+
+    mutable std::mutex mutex_;
+    std::deque<T> elements_;
+};
+}
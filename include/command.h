@@ -0,0 +1,44 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#pragma once
+
+#include <boost/utility/string_view.hpp>
+#include <experimental/optional>
+#include <string>
+#include <vector>
+
+namespace ohmyarch {
+enum class bot_command : std::uint8_t {
+    quote,
+    joke,
+    funny_pics,
+    girl_pics,
+    run_cpp,
+    about
+};
+
+// Resolves a bot_command entity such as "/quote" or "/quote@username" with a
+// single lookup in a perfect hash table built at startup.
+class command_registry {
+  public:
+    explicit command_registry(const std::string &username);
+
+    std::experimental::optional<bot_command>
+    find(boost::string_view text) const;
+
+  private:
+    struct entry {
+        std::string text;
+        bot_command command;
+    };
+
+    std::vector<entry> entries_;
+    // Index into entries_ plus one; 0 marks an empty slot.
+    std::vector<std::uint8_t> slots_;
+    std::uint32_t seed_;
+};
+}
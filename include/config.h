@@ -6,10 +6,98 @@
 
 #pragma once
 
+#include "bot.h"
+#include "bounded_queue.h"
+#include "dispatch.h"
+#include "local_backend.h"
+#include "send_scheduler.h"
+#include "trace.h"
+#include "upstream_guard.h"
+#include "webhook.h"
 #include <cpprest/http_client.h>
 #include <string>
 
 namespace ohmyarch {
-extern std::string api_uri;
+// Where the services the bot calls live. They can point at a stand-in such
+// as loadtest/mock_server.
+extern std::string telegram_uri;
+extern std::string jandan_uri;
+extern std::string forismatic_uri;
+extern std::string coliru_uri;
+
+// The bots served by the process, see bot.h.
+extern std::vector<bot::options> bots;
+
 extern web::http::client::http_client_config client_config;
+
+// Long polling: getUpdates blocks on the server for up to polling_timeout
+// seconds, so its client must wait a little longer than that.
+extern std::int32_t polling_timeout;
+extern std::int32_t polling_limit;
+extern web::http::client::http_client_config polling_client_config;
+
+// How often the getUpdates offsets of the bots are synced to disk, see
+// offset_store.h.
+extern std::chrono::milliseconds update_offset_sync_interval;
+
+// Commands that arrive more than stale_update_age after they were sent, such
+// as the backlog of a restart, are handled according to stale_policy.
+extern std::chrono::seconds stale_update_age;
+extern stale_update_policy stale_policy;
+
+// Limits for the shared HTTP clients, see http_pool.h.
+extern std::size_t max_connections_per_host;
+extern std::chrono::seconds connection_idle_timeout;
+
+// Number of threads running bot commands.
+extern std::size_t worker_threads;
+
+// Pending commands kept per chat, and what to do with the ones beyond that.
+extern std::size_t queue_capacity;
+extern overload_policy queue_overload_policy;
+
+// Jokes and pictures kept in memory per category, see prefetch_pool.h.
+extern std::size_t prefetch_capacity;
+extern std::size_t prefetch_low_watermark;
+extern std::chrono::seconds prefetch_ttl;
+
+// Outputs of /run_cpp kept per compiler command and source, see
+// result_cache.h. An empty path keeps them in memory only.
+extern std::size_t run_cpp_cache_capacity;
+extern std::chrono::seconds run_cpp_cache_ttl;
+extern std::string run_cpp_cache_path;
+
+// Where /run_cpp compiles snippets: "coliru" or "local", see
+// local_backend.h.
+extern std::string run_cpp_backend_name;
+extern local_backend::options local_backend_options;
+
+// Telegram's connections to the webhook of each bot, see set_webhook().
+extern std::int32_t webhook_max_connections;
+
+// Where metrics are served in the Prometheus text format, e.g.
+// "http://127.0.0.1:9100/metrics"; empty turns the endpoint off.
+extern std::string metrics_listen;
+
+// If not 0, this process only takes updates and runs their commands in that
+// many worker processes of its own, see shard.h.
+extern std::size_t shard_workers;
+
+// Deadlines and hedging of the calls to each upstream, indexed by upstream,
+// and when their circuits open, see upstream_guard.h. Only the calls to
+// jandan, forismatic and coliru are guarded.
+extern upstream_policy upstream_policies[upstream_count];
+extern std::chrono::milliseconds hedge_min_delay;
+extern circuit_breaker_limits breaker_limits;
+
+// Share of commands traced, from 0 to 1, and spans each thread keeps. On
+// SIGUSR1 the spans are written to trace_path in trace_format, see trace.h.
+extern double trace_sample_rate;
+extern std::size_t trace_buffer_spans;
+extern std::string trace_path;
+extern trace_format trace_file_format;
+
+// Telegram's flood limits, see send_scheduler.h. global_per_second applies
+// to each bot on its own.
+extern send_scheduler::limits send_limits;
 }
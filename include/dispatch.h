@@ -0,0 +1,90 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#pragma once
+
+#include "command.h"
+#include "message.h"
+#include "run_cpp_jobs.h"
+#include "utf16_cursor.h"
+#include <boost/functional/hash.hpp>
+#include <mutex>
+#include <unordered_set>
+
+namespace ohmyarch {
+// A command found in an update, waiting to be run for a chat.
+class queued_command {
+  public:
+    queued_command(bot_command command) : command_(command) {}
+    queued_command(const run_cpp_jobs::ticket &ticket,
+                   std::string &&code) noexcept
+        : command_(bot_command::run_cpp), ticket_(ticket),
+          code_(std::move(code)) {}
+
+    bot_command command() const { return command_; }
+    const run_cpp_jobs::ticket &ticket() const { return ticket_.value(); }
+    const std::string &code() const { return code_; }
+
+    // Equal for commands that would produce the same reply, never 0. An edit
+    // that leaves the code alone still differs from the version it replaces,
+    // which is skipped.
+    std::size_t signature() const;
+
+  private:
+    bot_command command_;
+    std::experimental::optional<run_cpp_jobs::ticket> ticket_;
+    std::string code_;
+};
+
+struct chat_command {
+    std::int64_t chat_id;
+    queued_command command;
+    // See trace.h; 0 if the command isn't traced.
+    std::uint64_t trace_id = 0;
+};
+
+// What to do with commands sent before a cutoff, like the backlog Telegram
+// kept while the bot was down: run them, drop them, or run only the newest
+// of each command per chat.
+enum class stale_update_policy : std::uint8_t { process, skip, collapse };
+
+// The stale commands of a bot already run under the collapse policy. A
+// backlog can take several getUpdates batches to drain, so each command runs
+// once per chat for the whole backlog: the newest one of the first batch it
+// is in. Forgotten at the first batch without stale updates.
+class stale_backlog {
+  public:
+    // Drops the stale commands in result that were run from an earlier batch
+    // or that a newer one of the same chat repeats.
+    void collapse(std::vector<chat_command> &result,
+                  const std::vector<bool> &stale, bool any_stale);
+
+  private:
+    using command_key = std::pair<std::int64_t, bot_command>;
+
+    std::mutex mutex_;
+    std::unordered_set<command_key, boost::hash<command_key>> seen_;
+};
+
+// The code of a /run_cpp message: every entity after the command has to be
+// code or pre.
+std::experimental::optional<std::string>
+extract_code(const std::vector<message_entity> &entities,
+             utf16_cursor &cursor);
+
+// The commands in updates, in the order they have to run. Each /run_cpp
+// message or edit of one starts a new generation in jobs. Messages dated
+// before stale_before (Unix time) are handled according to stale_policy;
+// without a backlog, collapsing only spans this batch.
+std::vector<chat_command> collect_commands(
+    const command_registry &commands, run_cpp_jobs &jobs,
+    const update_batch &updates,
+    stale_update_policy stale_policy = stale_update_policy::process,
+    std::int64_t stale_before = 0, stale_backlog *backlog = nullptr);
+
+// The reply to /run_cpp: every line of the output in a Markdown code span.
+std::string format_run_cpp_output(std::string output);
+}
@@ -0,0 +1,111 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#pragma once
+
+#include "bounded_queue.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <pplx/pplxtasks.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace ohmyarch {
+// A fixed set of worker threads starting tasks grouped into strands. A task
+// returns a pplx::task and counts as running until that task completes, so a
+// worker never waits on I/O. Tasks posted with the same key run one at a time
+// and in the order they were posted; different keys run in parallel. A strand
+// is queued on the worker its key hashes to, and idle workers steal strands
+// from busy ones. Idle workers sleep until new work is posted; nothing is
+// polled.
+//
+// Each strand holds at most queue_capacity tasks; policy decides what happens
+// to the overflow. Tasks posted with the same non-zero signature count as
+// duplicates for overload_policy::collapse_duplicates.
+class executor {
+  public:
+    executor(std::size_t threads, std::size_t queue_capacity,
+             overload_policy policy);
+
+    // Waits for running tasks to complete; queued ones are dropped.
+    ~executor();
+
+    executor(const executor &) = delete;
+    executor &operator=(const executor &) = delete;
+
+    // Returns false if the task was dropped or collapsed.
+    bool post(std::int64_t key, std::function<pplx::task<void>()> task,
+              std::size_t signature = 0);
+
+    std::size_t size() const { return workers_.size(); }
+    const queue_statistics &statistics() const { return statistics_; }
+
+    // Tasks waiting in all strands, and keys with a task queued or running.
+    // Both take the strands lock; they are meant for monitoring.
+    std::size_t queued() const;
+    std::size_t active_keys() const;
+
+  private:
+    struct job {
+        std::function<pplx::task<void>()> task;
+        std::size_t signature;
+    };
+
+    struct same_signature {
+        bool operator()(const job &a, const job &b) const {
+            return a.signature != 0 && a.signature == b.signature;
+        }
+    };
+
+    struct strand {
+        strand(std::size_t capacity, overload_policy policy,
+               queue_statistics &statistics)
+            : tasks(capacity, policy, statistics) {}
+
+        std::int64_t key;
+        std::size_t home;
+        bounded_queue<job, same_signature> tasks;
+        bool scheduled = false;
+    };
+
+    struct worker {
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::deque<std::shared_ptr<strand>> ready;
+        bool parked = false;
+        bool wake = false;
+        std::thread thread;
+    };
+
+    void run(std::size_t index);
+    std::shared_ptr<strand> pop(std::size_t index);
+    std::shared_ptr<strand> steal(std::size_t thief);
+    std::shared_ptr<strand> park(std::size_t index);
+    void execute(const std::shared_ptr<strand> &strand);
+    void finish(const std::shared_ptr<strand> &strand);
+    void enqueue(std::size_t index, std::shared_ptr<strand> strand);
+    void wake_sibling(std::size_t index);
+
+    const std::size_t queue_capacity_;
+    const overload_policy policy_;
+    queue_statistics statistics_;
+
+    std::vector<std::unique_ptr<worker>> workers_;
+
+    // Guards strands_, in_flight_ and the scheduled flag of every strand.
+    mutable std::mutex strands_mutex_;
+    std::unordered_map<std::int64_t, std::shared_ptr<strand>> strands_;
+    std::size_t in_flight_ = 0;
+    std::condition_variable idle_;
+
+    std::atomic<bool> stopping_{false};
+};
+}
@@ -7,9 +7,14 @@
 #pragma once
 
 #include <experimental/optional>
+#include <pplx/pplxtasks.h>
 #include <string>
 #include <vector>
 
 namespace ohmyarch {
-std::experimental::optional<std::vector<std::string>> get_funny_pics();
+// Fills the in-memory pool ahead of the first command.
+void prefetch_funny_pics();
+
+pplx::task<std::experimental::optional<std::vector<std::string>>>
+get_funny_pics();
 }
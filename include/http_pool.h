@@ -0,0 +1,35 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#pragma once
+
+#include "metrics.h"
+#include <cpprest/http_client.h>
+#include <string>
+
+namespace ohmyarch {
+// Sends request through a shared http_client for (base_uri, config), so
+// keep-alive connections and TLS sessions are reused across calls and threads.
+// At most max_connections_per_host requests are in flight per client; the
+// rest wait their turn. Clients idle for connection_idle_timeout are dropped.
+// Canceling token aborts the request, whether it is waiting or in flight.
+// The time until the body has arrived is recorded for upstream, unless token
+// has been canceled.
+pplx::task<web::http::http_response>
+pooled_request(upstream upstream, const std::string &base_uri,
+               const web::http::client::http_client_config &config,
+               web::http::http_request request,
+               pplx::cancellation_token token =
+                   pplx::cancellation_token::none());
+
+inline pplx::task<web::http::http_response>
+pooled_request(upstream upstream, const std::string &base_uri,
+               web::http::http_request request,
+               pplx::cancellation_token token =
+                   pplx::cancellation_token::none()) {
+    return pooled_request(upstream, base_uri, {}, std::move(request), token);
+}
+}
@@ -7,8 +7,12 @@
 #pragma once
 
 #include <experimental/optional>
+#include <pplx/pplxtasks.h>
 #include <string>
 
 namespace ohmyarch {
-std::experimental::optional<std::string> get_joke();
+// Fills the in-memory pool ahead of the first command.
+void prefetch_jokes();
+
+pplx::task<std::experimental::optional<std::string>> get_joke();
 }
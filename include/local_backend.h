@@ -0,0 +1,116 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#pragma once
+
+#include "run_cpp_backend.h"
+#include "sandbox.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sys/types.h>
+#include <thread>
+#include <vector>
+
+namespace ohmyarch {
+// Compiles and runs snippets on this machine with run_sandboxed(). The common
+// standard headers are precompiled once at startup, and a pool of worker
+// processes takes one snippet at a time each and runs the compiler and the
+// program in a directory of its own, each in a jail that only shows the
+// toolchain besides it.
+//
+// The workers are forked by a fork server, a process that stays
+// single-threaded. A worker that dies is replaced after a delay, which
+// doubles while its replacements keep dying. The fork server is forked in
+// the constructor, so it has to run before the process starts any other
+// thread.
+class local_backend : public run_cpp_backend {
+  public:
+    struct options {
+        std::string compiler;
+        std::vector<std::string> flags;
+        std::string directory;
+        std::size_t workers;
+        sandbox_limits compile_limits;
+        sandbox_limits run_limits;
+        // What the compiler and the programs need to see, read-only.
+        std::vector<std::string> toolchain;
+    };
+
+    explicit local_backend(const options &options);
+    ~local_backend();
+
+    local_backend(const local_backend &) = delete;
+    local_backend &operator=(const local_backend &) = delete;
+
+    // Whether the precompiled header could be built. Snippets still compile
+    // without it, just slower.
+    bool precompiled() const { return precompiled_; }
+
+    const std::string &command() const override { return command_; }
+
+    // A canceled job is skipped if it hasn't reached a worker yet; otherwise
+    // its worker kills the compiler or the program. Either way the task
+    // completes right away.
+    // Outputs of a compiler or program that timed out aren't cacheable.
+    pplx::task<std::experimental::optional<run_cpp_output>>
+    run(const std::string &code, pplx::cancellation_token token) override;
+
+  private:
+    // Shared by a job and the callback of its token.
+    struct job_progress {
+        std::mutex mutex;
+        // The socket of the worker running the job, or -1.
+        int socket = -1;
+    };
+
+    struct job {
+        std::string code;
+        pplx::task_completion_event<std::experimental::optional<run_cpp_output>>
+            done;
+        pplx::cancellation_token token;
+        std::shared_ptr<job_progress> progress;
+    };
+
+    struct worker {
+        std::string directory;
+        pid_t pid;
+        int socket;
+        std::thread thread;
+    };
+
+    enum class spawn_result { spawned, failed, no_fork_server };
+
+    void precompile();
+    spawn_result spawn(worker &worker);
+    bool respawn(worker &worker, std::chrono::milliseconds &delay);
+    void dispatch(worker &worker);
+
+    const options options_;
+    std::vector<std::string> compile_argv_;
+    // The toolchain and the precompiled header.
+    std::vector<std::string> compile_paths_;
+    std::string command_;
+    bool precompiled_ = false;
+
+    pid_t fork_server_ = -1;
+    // Guards fork_socket_; workers are asked for one at a time.
+    std::mutex fork_mutex_;
+    int fork_socket_ = -1;
+
+    std::vector<std::unique_ptr<worker>> workers_;
+
+    // Guards jobs_, live_workers_ and stopping_.
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::condition_variable stopped_;
+    std::deque<job> jobs_;
+    std::size_t live_workers_ = 0;
+    bool stopping_ = false;
+};
+}
@@ -6,14 +6,20 @@
 
 #pragma once
 
+#include <boost/utility/string_view.hpp>
 #include <experimental/optional>
+#include <functional>
+#include <memory>
+#include <pplx/pplxtasks.h>
 #include <string>
 #include <vector>
 
 namespace ohmyarch {
 enum class formatting_options : std::uint8_t { markdown_style, html_style };
 
-class update;
+enum class entity_type : std::uint8_t { bot_command, code, pre, other };
+
+class update_parser;
 
 class chat {
   public:
@@ -22,7 +28,7 @@ class chat {
     std::int64_t id() const { return id_; }
 
     friend class message;
-    friend std::experimental::optional<std::vector<update>> get_updates();
+    friend class update_parser;
 
   private:
     chat() {}
@@ -33,48 +39,45 @@ class chat {
 class message_entity {
   public:
     message_entity(message_entity &&other) noexcept
-        : type_(std::move(other.type_)), offset_(other.offset_),
-          length_(other.length_) {}
-    message_entity(const std::string &type, std::int32_t offset,
-                   std::int32_t length)
+        : type_(other.type_), offset_(other.offset_), length_(other.length_) {}
+    message_entity(entity_type type, std::int32_t offset, std::int32_t length)
         : type_(type), offset_(offset), length_(length) {}
 
-    const std::string &type() const { return type_; }
+    entity_type type() const { return type_; }
     std::int32_t offset() const { return offset_; }
     std::int32_t length() const { return length_; }
 
   private:
-    std::string type_;
+    entity_type type_;
     std::int32_t offset_;
     std::int32_t length_;
 };
 
+// Only messages with at least one bot_command entity are kept. text() points
+// into the buffer of the update_batch the message belongs to.
 class message {
   public:
     message(message &&other) noexcept
-        : id_(other.id_), chat_(std::move(other.chat_)),
-          text_(std::move(other.text_)), entities_(std::move(other.entities_)) {
-    }
+        : id_(other.id_), date_(other.date_), chat_(std::move(other.chat_)),
+          text_(other.text_), entities_(std::move(other.entities_)) {}
 
     std::int32_t id() const { return id_; }
+    // Unix time the message was sent, or last edited.
+    std::int64_t date() const { return date_; }
     const class chat &chat() const { return chat_; }
-    const std::experimental::optional<std::string> &text() const {
-        return text_;
-    }
-    const std::experimental::optional<std::vector<message_entity>> &
-    entities() const {
-        return entities_;
-    }
+    boost::string_view text() const { return text_; }
+    const std::vector<message_entity> &entities() const { return entities_; }
 
-    friend std::experimental::optional<std::vector<update>> get_updates();
+    friend class update_parser;
 
   private:
     message() {}
 
     std::int32_t id_;
+    std::int64_t date_;
     class chat chat_;
-    std::experimental::optional<std::string> text_;
-    std::experimental::optional<std::vector<message_entity>> entities_;
+    boost::string_view text_;
+    std::vector<message_entity> entities_;
 };
 
 class update {
@@ -91,7 +94,7 @@ class update {
         return edited_message_;
     }
 
-    friend std::experimental::optional<std::vector<update>> get_updates();
+    friend class update_parser;
 
   private:
     update() {}
@@ -101,14 +104,89 @@ class update {
     std::experimental::optional<class message> edited_message_;
 };
 
-std::experimental::optional<std::string> get_me();
+// The updates of one getUpdates response or webhook request, together with
+// the buffer their texts point into.
+class update_batch {
+  public:
+    update_batch(update_batch &&other) noexcept
+        : buffer_(std::move(other.buffer_)),
+          updates_(std::move(other.updates_)) {}
+
+    std::vector<update>::const_iterator begin() const {
+        return updates_.begin();
+    }
+    std::vector<update>::const_iterator end() const { return updates_.end(); }
+    std::size_t size() const { return updates_.size(); }
+    bool empty() const { return updates_.empty(); }
+
+    friend class update_parser;
+
+  private:
+    update_batch() {}
+
+    std::unique_ptr<char[]> buffer_;
+    std::vector<update> updates_;
+};
+
+class bot;
 
-std::experimental::optional<std::vector<update>> get_updates();
+std::experimental::optional<std::string> get_me(const bot &bot);
 
-void send_message(
-    std::int64_t chat_id, const std::string &text,
+using update_handler = std::function<void(const update_batch &)>;
+
+// Long-polls once from the bot's update offset and calls handler with the
+// updates that have a command, on a thread of the pplx pool. The offset moves
+// as soon as a batch is received, so a crash loses the commands of that batch
+// that hadn't run instead of replaying them. Errors are logged; the returned
+// task never fails.
+pplx::task<void> get_updates(bot &bot, const update_handler &handler);
+
+// Parses a getUpdates response. max_update_id is set to the largest update_id
+// in it, whether or not the update has a command. Nothing is returned if no
+// update has a command or the response doesn't parse.
+std::experimental::optional<update_batch>
+parse_updates(const std::string &body, std::int32_t &max_update_id);
+
+// Parses the body of a webhook request, which is a single Update. Nothing is
+// returned if it has no command or doesn't parse.
+std::experimental::optional<update_batch> parse_update(const std::string &body);
+
+// Telegram posts updates to url from then on, with secret_token in the
+// X-Telegram-Bot-Api-Secret-Token header, over at most max_connections
+// connections at once.
+bool set_webhook(const bot &bot, const std::string &url,
+                 const std::string &secret_token,
+                 std::int32_t max_connections);
+
+// Has to be called before getUpdates works again.
+bool delete_webhook(const bot &bot);
+
+// Sends go out as bot, which has to outlive them. Errors are logged; the
+// returned tasks never fail.
+pplx::task<void> send_message(
+    const bot &bot, std::int64_t chat_id, const std::string &text,
     std::experimental::optional<std::int32_t> rely_to = {},
     std::experimental::optional<formatting_options> parse_mode = {});
 
-void send_document(std::int64_t chat_id, const std::string &uri);
+// Like send_message, but yields the message_id of the sent message.
+pplx::task<std::experimental::optional<std::int32_t>> reply_message(
+    const bot &bot, std::int64_t chat_id, const std::string &text,
+    std::experimental::optional<std::int32_t> rely_to = {},
+    std::experimental::optional<formatting_options> parse_mode = {});
+
+pplx::task<void> edit_message_text(
+    const bot &bot, std::int64_t chat_id, std::int32_t message_id,
+    const std::string &text,
+    std::experimental::optional<formatting_options> parse_mode = {});
+
+pplx::task<void> send_document(const bot &bot, std::int64_t chat_id,
+                               const std::string &uri);
+
+// Sends waiting for Telegram's flood limits, see send_scheduler.h.
+std::size_t pending_sends();
+
+// Sends pictures in order. Runs of still images go out as sendMediaGroup
+// albums of up to 10 pictures; GIFs are sent as documents.
+pplx::task<void> send_pictures(const bot &bot, std::int64_t chat_id,
+                               const std::vector<std::string> &uris);
 }
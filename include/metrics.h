@@ -0,0 +1,108 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#pragma once
+
+#include "command.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cpprest/http_listener.h>
+#include <functional>
+#include <string>
+
+namespace ohmyarch {
+// The services the bot waits on.
+enum class upstream : std::uint8_t {
+    telegram,
+    telegram_polling, // getUpdates, which blocks for polling_timeout
+    jandan,
+    forismatic,
+    coliru,
+    local_compiler
+};
+
+constexpr std::size_t upstream_count = 6;
+
+// The label of upstream in the metrics, e.g. "jandan".
+const char *upstream_name(upstream upstream);
+
+// Counts durations in log-linear buckets, like HdrHistogram: 32 buckets per
+// power of two of microseconds, so a bucket is at most 1/32 wider than its
+// lower bound, from 1 µs up to about 38 hours. Recording is a couple of
+// relaxed atomic increments and takes no lock.
+class latency_histogram {
+  public:
+    static constexpr std::size_t sub_bucket_bits = 5;
+    static constexpr std::size_t sub_buckets = 1 << sub_bucket_bits;
+    static constexpr std::size_t max_bits = 37;
+    static constexpr std::size_t bucket_count =
+        (max_bits - sub_bucket_bits + 1) * sub_buckets;
+
+    void record(std::chrono::steady_clock::duration duration);
+
+    // Count of the values below upper_bound(index) that are not below
+    // upper_bound(index - 1).
+    std::uint64_t bucket(std::size_t index) const {
+        return buckets_[index].load(std::memory_order_relaxed);
+    }
+    static std::uint64_t upper_bound(std::size_t index);
+
+    std::uint64_t count() const {
+        return count_.load(std::memory_order_relaxed);
+    }
+    std::uint64_t sum_microseconds() const {
+        return sum_.load(std::memory_order_relaxed);
+    }
+
+    // The upper bound of the bucket holding the q-quantile, e.g. 0.95, of
+    // the values recorded so far; 0 if there are none.
+    std::uint64_t quantile_microseconds(double q) const;
+
+  private:
+    static std::size_t index_of(std::uint64_t microseconds);
+
+    std::array<std::atomic<std::uint64_t>, bucket_count> buckets_{};
+    std::atomic<std::uint64_t> count_{0};
+    std::atomic<std::uint64_t> sum_{0};
+};
+
+// From receipt of the command to completion of its last reply.
+void record_command(bot_command command,
+                    std::chrono::steady_clock::duration duration);
+
+// A failed call is a transport error or a non-2xx response.
+void record_upstream(upstream upstream,
+                     std::chrono::steady_clock::duration duration, bool failed);
+
+// The q-quantile of the recorded durations of upstream, or 0 while fewer
+// than min_count calls have been recorded.
+std::chrono::microseconds upstream_quantile(upstream upstream, double q,
+                                            std::uint64_t min_count);
+
+enum class metric_type : std::uint8_t { counter, gauge };
+
+// Adds a metric whose value is read when the metrics are rendered.
+void register_metric(const std::string &name, const std::string &help,
+                     metric_type type, std::function<double()> value);
+
+// Every metric in the Prometheus text format.
+std::string render_metrics();
+
+// Serves render_metrics() to GET requests on listen_uri.
+class metrics_endpoint {
+  public:
+    // Throws if the listener can't be opened.
+    explicit metrics_endpoint(const std::string &listen_uri);
+    ~metrics_endpoint();
+
+    metrics_endpoint(const metrics_endpoint &) = delete;
+    metrics_endpoint &operator=(const metrics_endpoint &) = delete;
+
+  private:
+    web::http::experimental::listener::http_listener listener_;
+};
+}
@@ -0,0 +1,45 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace ohmyarch {
+// Keeps the getUpdates offset in a file across restarts. Each advance is
+// written to the file right away, so a crash of the bot loses nothing, but
+// fdatasync runs at most once per sync_interval: a crash of the machine
+// replays at most that much of the updates. The record has a fixed width and
+// is overwritten in place.
+class offset_store {
+  public:
+    // Errors are logged; the store then only keeps the offset in memory.
+    offset_store(const std::string &path,
+                 std::chrono::milliseconds sync_interval);
+    ~offset_store();
+
+    offset_store(const offset_store &) = delete;
+    offset_store &operator=(const offset_store &) = delete;
+
+    // The saved offset, or -1.
+    std::int32_t offset() const { return offset_; }
+
+    void advance(std::int32_t offset);
+
+    // Syncs the last offset if it hasn't been.
+    void flush();
+
+  private:
+    const std::string path_;
+    const std::chrono::milliseconds sync_interval_;
+    int fd_ = -1;
+    std::int32_t offset_ = -1;
+    bool dirty_ = false;
+    std::chrono::steady_clock::time_point synced_;
+};
+}
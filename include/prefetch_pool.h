@@ -0,0 +1,220 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <experimental/optional>
+#include <functional>
+#include <mutex>
+#include <pplx/pplxtasks.h>
+#include <random>
+#include <spdlog/spdlog.h>
+#include <vector>
+
+namespace ohmyarch {
+// A bounded in-memory pool of items fetched ahead of time. Items expire ttl
+// after they were fetched. Whenever fewer than low_watermark are left, fetch
+// is called in the background, and again for as long as the pool stays below
+// the watermark and fetch keeps returning items. low_watermark has to be
+// above 0 and below capacity.
+//
+// Up to capacity expired items are kept until a refill brings new ones. When
+// the pool is empty and a refill brings nothing, as while the upstream's
+// circuit is open, take() falls back to the newest of them.
+template <typename T> class prefetch_pool {
+  public:
+    using fetcher = std::function<pplx::task<std::vector<T>>()>;
+
+    prefetch_pool(const std::string &name, fetcher fetch, std::size_t capacity,
+                  std::size_t low_watermark, std::chrono::seconds ttl)
+        : name_(name), fetch_(std::move(fetch)), capacity_(capacity),
+          low_watermark_(low_watermark), ttl_(ttl),
+          engine_(std::random_device()()) {}
+
+    // Takes a random item. If the pool is empty, waits for a refill.
+    pplx::task<std::experimental::optional<T>> take() {
+        std::experimental::optional<T> value;
+
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+
+            expire();
+
+            if (!entries_.empty()) {
+                value.emplace(pick());
+
+                if (entries_.size() < low_watermark_)
+                    start_refill();
+            }
+        }
+
+        if (value) {
+            run_pending_fetch();
+
+            return pplx::task_from_result(std::move(value));
+        }
+
+        return refill().then([this] {
+            std::lock_guard<std::mutex> guard(mutex_);
+
+            expire();
+
+            if (!entries_.empty())
+                return std::experimental::optional<T>(pick());
+
+            if (stale_.empty())
+                return std::experimental::optional<T>();
+
+            std::experimental::optional<T> value(std::move(stale_.back()));
+            stale_.pop_back();
+
+            return value;
+        });
+    }
+
+    // Starts a refill unless one is running. The task completes when the
+    // running refill does.
+    pplx::task<void> refill() {
+        pplx::task<void> done;
+
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+
+            done = pplx::create_task(start_refill());
+        }
+
+        run_pending_fetch();
+
+        return done;
+    }
+
+  private:
+    struct entry {
+        T value;
+        std::chrono::steady_clock::time_point expiry;
+    };
+
+    // Called with mutex_ held.
+    void expire() {
+        const auto now = std::chrono::steady_clock::now();
+
+        for (std::size_t i = 0; i < entries_.size();)
+            if (entries_[i].expiry <= now) {
+                if (stale_.size() >= capacity_)
+                    stale_.pop_front();
+                stale_.push_back(std::move(entries_[i].value));
+
+                entries_[i] = std::move(entries_.back());
+                entries_.pop_back();
+            } else {
+                ++i;
+            }
+    }
+
+    // Called with mutex_ held and entries_ not empty.
+    T pick() {
+        std::uniform_int_distribution<std::size_t> gen_index(
+            0, entries_.size() - 1);
+        const std::size_t index = gen_index(engine_);
+
+        T value = std::move(entries_[index].value);
+        entries_[index] = std::move(entries_.back());
+        entries_.pop_back();
+
+        return value;
+    }
+
+    // Called with mutex_ held. The fetch itself is started by
+    // run_pending_fetch() once the lock is released.
+    pplx::task_completion_event<void> start_refill() {
+        if (!refilling_) {
+            refilling_ = true;
+            fetch_pending_ = true;
+            refilled_ = pplx::task_completion_event<void>();
+        }
+
+        return refilled_;
+    }
+
+    void run_pending_fetch() {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+
+            if (!fetch_pending_)
+                return;
+
+            fetch_pending_ = false;
+        }
+
+        pplx::task<std::vector<T>> fetched;
+
+        try {
+            fetched = fetch_();
+        } catch (const std::exception &error) {
+            fetched = pplx::task_from_exception<std::vector<T>>(error);
+        }
+
+        fetched.then([this](pplx::task<std::vector<T>> task) {
+            std::vector<T> items;
+
+            try {
+                items = task.get();
+            } catch (const std::exception &error) {
+                spdlog::get("logger")->error("❌ {}: {}", name_, error.what());
+            }
+
+            pplx::task_completion_event<void> refilled;
+            bool again;
+
+            {
+                std::lock_guard<std::mutex> guard(mutex_);
+
+                if (!items.empty())
+                    stale_.clear();
+
+                const auto expiry = std::chrono::steady_clock::now() + ttl_;
+                std::size_t inserted = 0;
+                for (auto &item : items) {
+                    if (entries_.size() >= capacity_)
+                        break;
+
+                    entries_.push_back({std::move(item), expiry});
+                    ++inserted;
+                }
+
+                refilling_ = false;
+                refilled = refilled_;
+
+                // A fetch that added nothing won't be followed by one that
+                // does.
+                again = inserted != 0 && entries_.size() < low_watermark_;
+            }
+
+            refilled.set();
+
+            if (again)
+                refill();
+        });
+    }
+
+    const std::string name_;
+    const fetcher fetch_;
+    const std::size_t capacity_;
+    const std::size_t low_watermark_;
+    const std::chrono::seconds ttl_;
+
+    std::mutex mutex_;
+    std::vector<entry> entries_;
+    // Oldest first.
+    std::deque<T> stale_;
+    std::mt19937_64 engine_;
+    bool refilling_ = false;
+    bool fetch_pending_ = false;
+    pplx::task_completion_event<void> refilled_;
+};
+}
@@ -7,11 +7,14 @@
 #pragma once
 
 #include <experimental/optional>
+#include <pplx/pplxtasks.h>
 #include <string>
 
 namespace ohmyarch {
 class quote {
   public:
+    quote(const quote &other)
+        : author_(other.author_), text_(other.text_) {}
     quote(quote &&other) noexcept
         : author_(std::move(other.author_)), text_(std::move(other.text_)) {}
     quote(const std::string &author, const std::string &text)
@@ -33,5 +36,5 @@ class quote {
     ;
 };
 
-std::experimental::optional<quote> get_quote();
+pplx::task<std::experimental::optional<quote>> get_quote();
 }
@@ -0,0 +1,68 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#pragma once
+
+#include <chrono>
+#include <experimental/optional>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace ohmyarch {
+// A bounded LRU cache of command outputs, keyed by the SHA-256 of the command
+// and its input. Entries older than ttl are treated as missing.
+//
+// If path is not empty the cache survives restarts: the file is loaded on
+// construction and every insert is appended to it as one line of JSON. The
+// file is rewritten with only the live entries once it holds twice as many
+// lines as the cache can, and again on destruction so that lookups since the
+// last rewrite count for which entries are kept.
+class result_cache {
+  public:
+    result_cache(std::size_t capacity, std::chrono::seconds ttl,
+                 std::string path);
+    ~result_cache();
+
+    result_cache(const result_cache &) = delete;
+    result_cache &operator=(const result_cache &) = delete;
+
+    static std::string key(const std::string &command,
+                           const std::string &input);
+
+    std::experimental::optional<std::string> find(const std::string &key);
+    void insert(const std::string &key, const std::string &output);
+
+  private:
+    using clock = std::chrono::system_clock;
+
+    struct entry {
+        std::string key;
+        std::string output;
+        clock::time_point time;
+    };
+
+    void put(entry value);
+    void load();
+    void compact();
+    void append(const entry &value);
+
+    const std::size_t capacity_;
+    const std::chrono::seconds ttl_;
+    const std::string path_;
+
+    std::mutex mutex_;
+
+    // Most recently used first.
+    std::list<entry> entries_;
+    std::unordered_map<std::string, std::list<entry>::iterator> index_;
+
+    std::ofstream journal_;
+    std::size_t journal_lines_ = 0;
+};
+}
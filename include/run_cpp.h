@@ -6,9 +6,19 @@
 
 #pragma once
 
+#include "run_cpp_backend.h"
 #include <experimental/optional>
+#include <memory>
+#include <pplx/pplxtasks.h>
 #include <string>
 
 namespace ohmyarch {
-std::experimental::optional<std::string> run_cpp(const std::string &code);
+// Canceling token abandons the run; the task then yields nothing.
+pplx::task<std::experimental::optional<std::string>>
+run_cpp(const std::string &code,
+        pplx::cancellation_token token = pplx::cancellation_token::none());
+
+// Replaces the default coliru_backend. Has to be called before the first
+// run_cpp().
+void set_run_cpp_backend(std::unique_ptr<run_cpp_backend> backend);
 }
@@ -0,0 +1,46 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#pragma once
+
+#include <experimental/optional>
+#include <pplx/pplxtasks.h>
+#include <string>
+
+namespace ohmyarch {
+// The output of the compiler followed by that of the program.
+struct run_cpp_output {
+    std::string text;
+    // False if the output may say more about the moment than about the
+    // snippet, like a compiler that timed out under load. Only cacheable
+    // outputs are cached.
+    bool cacheable;
+};
+
+// Compiles and runs a C++ snippet for /run_cpp.
+class run_cpp_backend {
+  public:
+    virtual ~run_cpp_backend() = default;
+
+    // The command line the snippet is built and run with. Outputs are cached
+    // by it, so it has to change whenever the output could.
+    virtual const std::string &command() const = 0;
+
+    // Nothing if the backend failed or token was canceled.
+    virtual pplx::task<std::experimental::optional<run_cpp_output>>
+    run(const std::string &code, pplx::cancellation_token token) = 0;
+};
+
+// Runs snippets on coliru.stacked-crooked.com.
+class coliru_backend : public run_cpp_backend {
+  public:
+    const std::string &command() const override;
+
+    // Error responses are logged and give nothing.
+    pplx::task<std::experimental::optional<run_cpp_output>>
+    run(const std::string &code, pplx::cancellation_token token) override;
+};
+}
@@ -0,0 +1,60 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#pragma once
+
+#include <boost/functional/hash.hpp>
+#include <deque>
+#include <experimental/optional>
+#include <mutex>
+#include <pplx/pplxtasks.h>
+#include <unordered_map>
+
+namespace ohmyarch {
+// Tracks /run_cpp messages by (chat_id, message_id). Every version of a
+// message, the original and each edit, gets a new generation; starting one
+// cancels the run of the previous version, and a queued run whose generation
+// is no longer current is skipped. The reply to the first version is
+// remembered, so later versions edit it instead of sending a new one.
+//
+// Only the last capacity messages are remembered; an edit of an older one
+// is treated like a new message.
+class run_cpp_jobs {
+  public:
+    struct ticket {
+        std::int64_t chat_id;
+        std::int32_t message_id;
+        std::uint64_t generation;
+        pplx::cancellation_token token;
+    };
+
+    explicit run_cpp_jobs(std::size_t capacity) : capacity_(capacity) {}
+
+    ticket start(std::int64_t chat_id, std::int32_t message_id);
+
+    bool current(const ticket &ticket) const;
+
+    // The reply sent for an earlier version of the message, if any.
+    std::experimental::optional<std::int32_t> reply(const ticket &ticket) const;
+    void set_reply(const ticket &ticket, std::int32_t reply_id);
+
+  private:
+    using message_key = std::pair<std::int64_t, std::int32_t>;
+
+    struct entry {
+        std::uint64_t generation = 0;
+        pplx::cancellation_token_source source;
+        std::experimental::optional<std::int32_t> reply_id;
+    };
+
+    const std::size_t capacity_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<message_key, entry, boost::hash<message_key>> entries_;
+    // Keys in the order they were first seen, for eviction.
+    std::deque<message_key> order_;
+};
+}
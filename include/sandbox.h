@@ -0,0 +1,54 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace ohmyarch {
+struct sandbox_limits {
+    std::chrono::milliseconds wall_time;
+    std::uint64_t cpu_seconds;
+    std::uint64_t memory_bytes;
+    std::uint64_t file_bytes;
+    std::size_t output_bytes;
+    // Processes and threads of the program, counted within the jail; before
+    // Linux 5.14, all those of the bot's user count. Root isn't bound by it.
+    std::uint64_t processes;
+};
+
+struct sandbox_result {
+    // stdout and stderr, interleaved as they were written.
+    std::string output;
+    // As returned by waitpid().
+    int status;
+    bool timed_out;
+    bool truncated;
+    bool canceled;
+};
+
+// Runs argv in directory and collects its output. The process is jailed in
+// fresh user, mount, PID, network, IPC, UTS and cgroup namespaces. Its root
+// is an empty read-only tmpfs with only the read_only paths (the toolchain)
+// bound at their own paths, /dev/null and the random devices, a private /tmp
+// of file_bytes, and directory, the only writable one. It keeps the bot's uid,
+// but has nothing of the bot's to read, and can only signal processes of its
+// own namespace. It gets stdin from /dev/null, runs under the resource
+// limits, and has a seccomp filter that denies syscalls a snippet has no
+// business making (sockets, ptrace, namespaces, mounts, modules, ...). The
+// whole jail is killed once wall_time is up, output_bytes have been written
+// or cancel, unless it is -1, has become readable.
+//
+// Forks, so it may only be called from a single-threaded process. Throws
+// std::system_error if the process can't be started, which is the case
+// when the kernel doesn't allow user namespaces.
+sandbox_result run_sandboxed(const std::vector<std::string> &argv,
+                             const std::string &directory,
+                             const std::vector<std::string> &read_only,
+                             const sandbox_limits &limits, int cancel = -1);
+}
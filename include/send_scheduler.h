@@ -0,0 +1,112 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#pragma once
+
+#include <boost/functional/hash.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cpprest/http_msg.h>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace ohmyarch {
+enum class send_priority : std::uint8_t { high, normal, low };
+
+// Paces sends to Telegram's flood limits. A send has to take a token from
+// the bucket of its bot and from the bucket of its chat with that bot
+// (private chats and groups have different rates); sends waiting for tokens
+// are queued by priority and then by arrival. A chat has one send in flight
+// at a time. A 429 response holds the chat back for retry_after seconds and
+// the send is tried again, up to max_retries times, before the chat's later
+// sends. One scheduler serves every bot of the process.
+class send_scheduler {
+  public:
+    using sender = std::function<pplx::task<web::http::http_response>()>;
+
+    struct limits {
+        double global_per_second;
+        double private_per_second;
+        double group_per_second;
+        std::size_t max_retries;
+    };
+
+    explicit send_scheduler(const limits &limits);
+    ~send_scheduler();
+
+    send_scheduler(const send_scheduler &) = delete;
+    send_scheduler &operator=(const send_scheduler &) = delete;
+
+    // Sends waiting for tokens or for their turn.
+    std::size_t pending() const;
+
+    // send is called once per attempt and has to build a fresh request.
+    pplx::task<web::http::http_response> schedule(std::size_t bot,
+                                                  std::int64_t chat_id,
+                                                  send_priority priority,
+                                                  sender send);
+
+  private:
+    using clock = std::chrono::steady_clock;
+
+    struct token_bucket {
+        double tokens;
+        double rate;
+        double burst;
+        clock::time_point updated;
+        clock::time_point blocked_until;
+
+        void refill(clock::time_point now);
+        clock::time_point ready_at(clock::time_point now);
+    };
+
+    // A chat as seen by one bot.
+    using chat_key = std::pair<std::size_t, std::int64_t>;
+
+    struct item {
+        chat_key chat;
+        sender send;
+        std::size_t attempts;
+        pplx::task_completion_event<web::http::http_response> done;
+        // The trace of the caller, see trace.h, and when the item last went
+        // into the queue.
+        std::uint64_t trace;
+        clock::time_point queued;
+    };
+
+    // Ordered by priority, then by sequence number.
+    using queue_key = std::pair<send_priority, std::uint64_t>;
+
+    void run();
+    void dispatch(queue_key key, item next);
+    void release(const chat_key &chat);
+    token_bucket &bot_bucket(std::size_t bot, clock::time_point now);
+    token_bucket &chat_bucket(const chat_key &chat, clock::time_point now);
+
+    const limits limits_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable condition_;
+    std::map<queue_key, item> queue_;
+    std::uint64_t sequence_ = 0;
+    std::unordered_map<std::size_t, token_bucket> bots_;
+    std::unordered_map<chat_key, token_bucket, boost::hash<chat_key>> chats_;
+    // Sequence numbers of the queued and in-flight sends of each chat, oldest
+    // first. Only the oldest send of a chat may go out, and it stays here
+    // until it is answered, so a chat's messages keep their order whatever
+    // their priorities and retries.
+    std::unordered_map<chat_key, std::deque<std::uint64_t>,
+                       boost::hash<chat_key>>
+        chat_order_;
+    bool stopping_ = false;
+
+    std::thread thread_;
+};
+}
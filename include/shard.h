@@ -0,0 +1,124 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#pragma once
+
+#include "command.h"
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <vector>
+
+namespace ohmyarch {
+// A command as the ingress hands it to a worker process. message_id and code
+// are only set for /run_cpp.
+struct shard_command {
+    std::uint64_t sequence;
+    std::uint8_t bot;
+    bot_command command;
+    std::int64_t chat_id;
+    std::int32_t message_id;
+    std::uint64_t trace_id;
+    std::string code;
+};
+
+// The worker a chat of a bot belongs to, by jump consistent hash: going from
+// n to n + 1 workers moves only a 1 / (n + 1) share of the chats.
+std::size_t shard_of(std::size_t bot, std::int64_t chat_id,
+                     std::size_t workers);
+
+// Runs the commands of the ingress process in worker processes, which it
+// starts and supervises. Every chat goes to the same worker, over a Unix
+// domain socket, so its commands keep their order. Each worker has a thread
+// that writes its commands and one that reads which are done with.
+//
+// A command stays with the ingress until the worker reports it done with,
+// run or dropped. When a worker dies it is restarted, and gets the commands
+// it hadn't finished again in their original order before any new one. A
+// command running when its worker died may thus be run twice.
+class shard_router {
+  public:
+    // Each worker is started as program with arguments, plus
+    // "--shard <index>" and "--shard-socket <fd>".
+    shard_router(const std::string &program,
+                 const std::vector<std::string> &arguments,
+                 std::size_t workers);
+
+    // Closes the sockets, so the workers finish what they are running and
+    // exit, and waits for them. Commands they hadn't finished are lost.
+    ~shard_router();
+
+    shard_router(const shard_router &) = delete;
+    shard_router &operator=(const shard_router &) = delete;
+
+    // Only queues the command, so it never blocks on a worker. Called from
+    // any thread.
+    void route(shard_command command);
+
+    std::size_t size() const { return workers_.size(); }
+
+    // Commands handed to workers and not yet done with. Meant for
+    // monitoring.
+    std::size_t pending() const;
+
+  private:
+    struct worker {
+        std::size_t index;
+        // Guards everything below.
+        mutable std::mutex mutex;
+        // Notified when there is something to send or sending is over.
+        std::condition_variable changed;
+        pid_t pid = -1;
+        // -1 while the worker is being restarted.
+        int socket = -1;
+        std::uint64_t next_sequence = 0;
+        // The commands with a sequence below this have been sent.
+        std::uint64_t next_unsent = 0;
+        // Whether the writer is using the socket without the mutex.
+        bool sending = false;
+        std::map<std::uint64_t, std::string> unfinished;
+        std::thread reader;
+        std::thread writer;
+    };
+
+    // Called with the worker's mutex held.
+    void spawn(worker &worker);
+    void read(worker &worker);
+    void write(worker &worker);
+
+    const std::string program_;
+    const std::vector<std::string> arguments_;
+
+    std::vector<std::unique_ptr<worker>> workers_;
+    std::atomic<bool> stopping_{false};
+};
+
+// The worker's end of the socket to the ingress.
+class shard_inbox {
+  public:
+    explicit shard_inbox(int socket) : socket_(socket) {}
+    ~shard_inbox();
+
+    shard_inbox(const shard_inbox &) = delete;
+    shard_inbox &operator=(const shard_inbox &) = delete;
+
+    // Blocks until the next command arrives. Returns false once the ingress
+    // has closed the socket.
+    bool receive(shard_command &command);
+
+    // Tells the ingress the command is done with. Called from any thread.
+    void finish(std::uint64_t sequence);
+
+  private:
+    const int socket_;
+    std::mutex send_mutex_;
+};
+}
@@ -0,0 +1,29 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace ohmyarch {
+// Blocking I/O on stream sockets between processes of the bot. They return
+// false once the other end is gone; EINTR is retried and SIGPIPE is never
+// raised.
+bool send_all(int socket, const void *data, std::size_t size);
+bool receive_all(int socket, void *data, std::size_t size);
+
+// A frame is its size as a 32-bit integer in host byte order, followed by
+// its bytes. Both ends always run on the same machine.
+bool send_frame(int socket, const std::string &payload);
+bool receive_frame(int socket, std::string &payload);
+
+// A value that carries a descriptor over a Unix socket, or -1 for none. The
+// received descriptor is close-on-exec.
+bool send_descriptor(int socket, std::int32_t value, int descriptor);
+bool receive_descriptor(int socket, std::int32_t &value, int &descriptor);
+}
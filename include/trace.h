@@ -0,0 +1,78 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+namespace ohmyarch {
+// Spans of sampled commands: where the time between the getUpdates response
+// and the last reply went. A trace is a random non-zero id, 0 being "not
+// sampled"; every span of a command carries it, across threads and shard
+// workers. Spans go into a ring buffer of the recording thread, which keeps
+// the last trace_buffer_spans of them, and are only gathered for an export.
+using trace_clock = std::chrono::steady_clock;
+
+// A new trace id with probability trace_sample_rate, otherwise 0.
+std::uint64_t start_trace();
+
+// Does nothing for trace 0. name has to be a string literal.
+void record_span(std::uint64_t trace, const char *name,
+                 trace_clock::time_point start, trace_clock::time_point end,
+                 std::int64_t chat_id = 0);
+
+// The trace the calling thread is working for, which the send functions and
+// the send scheduler pick up. Continuations run elsewhere, so they have to
+// capture it and open a trace_scope of their own.
+std::uint64_t current_trace();
+
+class trace_scope {
+  public:
+    explicit trace_scope(std::uint64_t trace);
+    ~trace_scope();
+
+    trace_scope(const trace_scope &) = delete;
+    trace_scope &operator=(const trace_scope &) = delete;
+
+  private:
+    const std::uint64_t previous_;
+};
+
+// chrome is the JSON of chrome://tracing and Perfetto, one row per trace.
+// otlp is the OTLP/JSON encoding of an ExportTraceServiceRequest, which the
+// OpenTelemetry Collector's otlpjsonfile receiver reads.
+enum class trace_format : std::uint8_t { chrome, otlp };
+
+// Writes every buffered span to path, through a temporary file. Returns the
+// number of spans, and throws if the file can't be written.
+std::size_t write_traces(const std::string &path, trace_format format);
+
+// Async-signal-safe: asks the trace_exporter to write the spans.
+void request_trace_export();
+
+// Writes the spans when asked to by request_trace_export(), from a thread of
+// its own.
+class trace_exporter {
+  public:
+    trace_exporter(const std::string &path, trace_format format);
+    ~trace_exporter();
+
+    trace_exporter(const trace_exporter &) = delete;
+    trace_exporter &operator=(const trace_exporter &) = delete;
+
+  private:
+    void run();
+
+    const std::string path_;
+    const trace_format format_;
+    std::atomic<bool> stopping_{false};
+    std::thread thread_;
+};
+}
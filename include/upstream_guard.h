@@ -0,0 +1,61 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#pragma once
+
+#include "metrics.h"
+#include <chrono>
+#include <cpprest/http_client.h>
+#include <stdexcept>
+#include <string>
+
+namespace ohmyarch {
+// How the calls to one upstream are bounded, see guarded_request().
+struct upstream_policy {
+    // The budget of a call, from waiting for a connection to the last byte
+    // of the body; 0 for none.
+    std::chrono::milliseconds deadline;
+    // Whether a GET still unanswered after the upstream's p95 latency gets
+    // a second copy.
+    bool hedge;
+};
+
+// Each upstream has a circuit breaker, which opens once failure_rate of its
+// last window calls have failed. While open, calls fail at once. After
+// cooldown a single call goes through as a probe, and its outcome closes
+// the breaker or opens it again.
+struct circuit_breaker_limits {
+    std::size_t window;
+    double failure_rate;
+    std::chrono::seconds cooldown;
+};
+
+// What a guarded call fails with when the circuit of its upstream is open or
+// its deadline has passed.
+class upstream_error : public std::runtime_error {
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+// pooled_request() under the upstream_policies and breaker_limits of
+// config.h.
+//
+// A hedged GET sends a copy of itself once it has waited for the upstream's
+// p95 latency, but at least hedge_min_delay; the first 2xx response wins and
+// the other copy is canceled. Nothing is hedged until 100 calls to the
+// upstream have been recorded. Calls canceled through token don't count
+// towards the breaker.
+pplx::task<web::http::http_response>
+guarded_request(upstream upstream, const std::string &base_uri,
+                web::http::http_request request,
+                pplx::cancellation_token token =
+                    pplx::cancellation_token::none());
+
+// Copies sent by hedging, and calls refused by an open circuit. Meant for
+// monitoring.
+std::uint64_t hedged_requests();
+std::uint64_t rejected_requests();
+}
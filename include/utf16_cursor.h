@@ -0,0 +1,35 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#pragma once
+
+#include <boost/utility/string_view.hpp>
+#include <cstdint>
+
+namespace ohmyarch {
+// Telegram counts entity offsets and lengths in UTF-16 code units. A cursor
+// maps them to byte ranges of the UTF-8 text by scanning forward from the
+// previous entity, skipping ASCII runs a block at a time, without converting
+// or copying the text. Entities arrive sorted by offset; an offset behind the
+// cursor restarts the scan from the beginning.
+class utf16_cursor {
+  public:
+    explicit utf16_cursor(boost::string_view text) : text_(text) {}
+
+    boost::string_view slice(std::int32_t offset, std::int32_t length);
+
+  private:
+    struct position {
+        std::size_t byte;
+        std::int64_t unit;
+    };
+
+    position advance(position from, std::int64_t unit) const;
+
+    boost::string_view text_;
+    position position_{0, 0};
+};
+}
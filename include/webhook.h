@@ -0,0 +1,45 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#pragma once
+
+#include "message.h"
+#include <cpprest/http_listener.h>
+#include <functional>
+#include <string>
+
+namespace ohmyarch {
+// Receives the updates Telegram pushes after set_webhook(). Listens on
+// listen_uri, either plain http:// behind a reverse proxy or https:// with
+// certificate and private_key (PEM files). Requests without secret_token,
+// which is required, are refused; the others are answered right away, and
+// then their updates are passed to handler on the listener's threads.
+class webhook {
+  public:
+    using handler = std::function<void(const update_batch &)>;
+
+    struct options {
+        std::string listen_uri;
+        std::string secret_token;
+        std::string certificate;
+        std::string private_key;
+    };
+
+    // Throws if the listener can't be opened or secret_token is empty.
+    webhook(const options &options, handler handler);
+    ~webhook();
+
+    webhook(const webhook &) = delete;
+    webhook &operator=(const webhook &) = delete;
+
+  private:
+    void receive(web::http::http_request request);
+
+    const std::string secret_token_;
+    const handler handler_;
+    web::http::experimental::listener::http_listener listener_;
+};
+}
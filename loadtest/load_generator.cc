@@ -0,0 +1,368 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+// Drives the bot through mock_server with synthetic private chats. Each chat
+// sends a random command, waits for the bot's first send to it, thinks for a
+// random time around think_time, and sends the next one. A command that gets
+// no reply within reply_timeout is counted as lost and the chat moves on.
+//
+// Start this first, then the bot with loadtest/bot_config.json:
+//
+//     load_generator --chats 5000 --duration 60 --latency 20 --jitter 30
+//
+// Latency is measured from the getUpdates response that carried a command to
+// the reply that completed it, and recorded only after the warmup.
+
+#include "metrics.h"
+#include "mock_server.h"
+#include <algorithm>
+#include <boost/program_options.hpp>
+#include <csignal>
+#include <iostream>
+#include <queue>
+
+namespace {
+std::atomic<bool> keep_running(true);
+
+void signal_handler(int signal) { keep_running = false; }
+
+using clock_type = std::chrono::steady_clock;
+
+const char *const command_texts[] = {"/quote",     "/joke",    "/funny_pics",
+                                     "/girl_pics", "/run_cpp", "/about"};
+
+class load_generator {
+  public:
+    load_generator(std::size_t chats, std::chrono::milliseconds think_time,
+                   std::chrono::milliseconds reply_timeout,
+                   std::vector<std::string> commands,
+                   clock_type::time_point measure_from)
+        : think_time_(think_time), reply_timeout_(reply_timeout),
+          commands_(std::move(commands)), measure_from_(measure_from),
+          chats_(chats) {
+        const auto now = clock_type::now();
+        for (std::size_t index = 0; index < chats; ++index)
+            ready_.emplace(now + think(), index);
+    }
+
+    // An update for every chat whose think time is over.
+    std::vector<nlohmann::json> due(clock_type::time_point now) {
+        std::vector<nlohmann::json> updates;
+
+        std::lock_guard<std::mutex> guard(mutex_);
+
+        while (!ready_.empty() && ready_.top().first <= now) {
+            const std::size_t index = ready_.top().second;
+            ready_.pop();
+
+            chats_[index].waiting = true;
+            chats_[index].sent = now;
+
+            updates.push_back(command_update(index));
+        }
+
+        return updates;
+    }
+
+    void on_send(std::int64_t chat_id) {
+        const auto now = clock_type::now();
+        const auto index = static_cast<std::size_t>(chat_id - first_chat_id);
+
+        std::lock_guard<std::mutex> guard(mutex_);
+
+        if (index >= chats_.size() || !chats_[index].waiting) {
+            // The rest of an album, or a late reply to a lost command.
+            ++extra_sends_;
+
+            return;
+        }
+
+        auto &chat = chats_[index];
+        chat.waiting = false;
+        if (chat.sent >= measure_from_) {
+            latency_.record(now - chat.sent);
+            ++completed_;
+        }
+
+        ready_.emplace(now + think(), index);
+    }
+
+    // Gives up on the commands that have waited longer than reply_timeout.
+    void expire(clock_type::time_point now) {
+        std::lock_guard<std::mutex> guard(mutex_);
+
+        for (std::size_t index = 0; index < chats_.size(); ++index) {
+            auto &chat = chats_[index];
+            if (!chat.waiting || now - chat.sent < reply_timeout_)
+                continue;
+
+            chat.waiting = false;
+            if (chat.sent >= measure_from_)
+                ++lost_;
+
+            ready_.emplace(now, index);
+        }
+    }
+
+    std::uint64_t completed() const {
+        std::lock_guard<std::mutex> guard(mutex_);
+
+        return completed_;
+    }
+    std::uint64_t lost() const {
+        std::lock_guard<std::mutex> guard(mutex_);
+
+        return lost_;
+    }
+    std::uint64_t extra_sends() const {
+        std::lock_guard<std::mutex> guard(mutex_);
+
+        return extra_sends_;
+    }
+    const ohmyarch::latency_histogram &latency() const { return latency_; }
+
+  private:
+    static constexpr std::int64_t first_chat_id = 100000000;
+
+    struct chat {
+        bool waiting = false;
+        clock_type::time_point sent;
+    };
+
+    using ready_chat = std::pair<clock_type::time_point, std::size_t>;
+
+    // Uniform in [0, 2 * think_time), so the chats drift apart.
+    clock_type::duration think() {
+        return std::chrono::microseconds(
+            std::uniform_int_distribution<std::int64_t>(
+                0, 2000 * think_time_.count())(engine_));
+    }
+
+    nlohmann::json command_update(std::size_t index) {
+        const std::int64_t chat_id = first_chat_id + index;
+        const std::string &command = commands_[std::uniform_int_distribution<
+            std::size_t>(0, commands_.size() - 1)(engine_)];
+
+        std::string text = command;
+        nlohmann::json entities = nlohmann::json::array(
+            {{{"offset", 0}, {"length", command.size()},
+              {"type", "bot_command"}}});
+
+        // Every snippet differs, so none is answered from the cache.
+        if (command == "/run_cpp") {
+            const std::string code =
+                "#include <iostream>\nint main() { std::cout << " +
+                std::to_string(++message_id_) + " << '\\n'; }";
+
+            text += '\n' + code;
+            entities.push_back({{"offset", command.size() + 1},
+                                {"length", code.size()},
+                                {"type", "pre"}});
+        }
+
+        return {{"message",
+                 {{"message_id", ++message_id_},
+                  {"from",
+                   {{"id", chat_id},
+                    {"is_bot", false},
+                    {"first_name", "load"}}},
+                  {"chat", {{"id", chat_id}, {"type", "private"}}},
+                  {"date", std::chrono::duration_cast<std::chrono::seconds>(
+                               std::chrono::system_clock::now()
+                                   .time_since_epoch())
+                               .count()},
+                  {"text", text},
+                  {"entities", entities}}}};
+    }
+
+    const std::chrono::milliseconds think_time_;
+    const std::chrono::milliseconds reply_timeout_;
+    const std::vector<std::string> commands_;
+    const clock_type::time_point measure_from_;
+
+    // Guards everything below but latency_.
+    mutable std::mutex mutex_;
+    std::vector<chat> chats_;
+    std::priority_queue<ready_chat, std::vector<ready_chat>,
+                        std::greater<ready_chat>>
+        ready_;
+    std::mt19937_64 engine_{std::random_device()()};
+    std::int64_t message_id_ = 0;
+    std::uint64_t completed_ = 0;
+    std::uint64_t lost_ = 0;
+    std::uint64_t extra_sends_ = 0;
+
+    ohmyarch::latency_histogram latency_;
+};
+
+// The upper bound of the bucket holding the given quantile, in milliseconds.
+double quantile(const ohmyarch::latency_histogram &histogram,
+                double fraction) {
+    std::uint64_t total = 0;
+    for (std::size_t index = 0;
+         index < ohmyarch::latency_histogram::bucket_count; ++index)
+        total += histogram.bucket(index);
+    if (total == 0)
+        return 0.0;
+
+    const auto rank = static_cast<std::uint64_t>(fraction * total);
+
+    std::uint64_t cumulative = 0;
+    for (std::size_t index = 0;
+         index < ohmyarch::latency_histogram::bucket_count; ++index) {
+        cumulative += histogram.bucket(index);
+        if (cumulative > rank)
+            return ohmyarch::latency_histogram::upper_bound(index) / 1e3;
+    }
+
+    return ohmyarch::latency_histogram::upper_bound(
+               ohmyarch::latency_histogram::bucket_count - 1) /
+           1e3;
+}
+}
+
+int main(int argc, char *argv[]) {
+    std::string listen_uri;
+    std::size_t chats;
+    std::int64_t duration;
+    std::int64_t warmup;
+    std::int64_t think_time;
+    std::int64_t reply_timeout;
+    std::vector<std::string> commands;
+    std::int64_t latency;
+    std::int64_t jitter;
+    double error_rate;
+    double throttle_rate;
+    std::int32_t retry_after;
+
+    namespace po = boost::program_options;
+
+    po::options_description options("options");
+    options.add_options()(
+        "listen",
+        po::value(&listen_uri)->default_value("http://127.0.0.1:8081/"),
+        "where the mock services listen")(
+        "chats", po::value(&chats)->default_value(1000),
+        "synthetic chats, each with one command in flight at a time")(
+        "duration", po::value(&duration)->default_value(60),
+        "seconds measured after the warmup")(
+        "warmup", po::value(&warmup)->default_value(10),
+        "seconds run before measuring")(
+        "think-time", po::value(&think_time)->default_value(1000),
+        "mean milliseconds a chat waits between a reply and its next "
+        "command")(
+        "reply-timeout", po::value(&reply_timeout)->default_value(30000),
+        "milliseconds after which a command counts as lost")(
+        "commands",
+        po::value(&commands)->multitoken()->default_value(
+            {command_texts, command_texts + 6}, "all of them"),
+        "commands to pick from at random")(
+        "latency", po::value(&latency)->default_value(0),
+        "milliseconds added to every mock reply but getUpdates")(
+        "jitter", po::value(&jitter)->default_value(0),
+        "up to this many more milliseconds, uniformly")(
+        "error-rate", po::value(&error_rate)->default_value(0.0),
+        "share of mock replies that fail with a 500")(
+        "throttle-rate", po::value(&throttle_rate)->default_value(0.0),
+        "share of Bot API sends refused with a 429")(
+        "retry-after", po::value(&retry_after)->default_value(1),
+        "retry_after of the 429s, in seconds")("help", "print this message");
+
+    po::variables_map map;
+
+    try {
+        po::store(po::parse_command_line(argc, argv, options), map);
+        po::notify(map);
+    } catch (const po::error &error) {
+        std::cerr << "❌ " << error.what() << std::endl;
+
+        return 1;
+    }
+
+    if (map.count("help")) {
+        std::cout << options << std::endl;
+
+        return 0;
+    }
+
+    if (chats == 0 || commands.empty()) {
+        std::cerr << "❌ nothing to send" << std::endl;
+
+        return 1;
+    }
+
+    const auto start = clock_type::now();
+    const auto measure_from = start + std::chrono::seconds(warmup);
+    const auto end = measure_from + std::chrono::seconds(duration);
+
+    load_generator generator(chats, std::chrono::milliseconds(think_time),
+                             std::chrono::milliseconds(reply_timeout),
+                             commands, measure_from);
+
+    std::unique_ptr<ohmyarch::mock_server> server;
+    try {
+        server.reset(new ohmyarch::mock_server(
+            {listen_uri, std::chrono::milliseconds(latency),
+             std::chrono::milliseconds(jitter), error_rate, throttle_rate,
+             retry_after},
+            [&generator](std::int64_t chat_id) {
+                generator.on_send(chat_id);
+            }));
+    } catch (const std::exception &error) {
+        std::cerr << "❌ mock_server: " << error.what() << std::endl;
+
+        return 1;
+    }
+
+    std::signal(SIGINT, signal_handler);
+    std::signal(SIGTERM, signal_handler);
+
+    std::cout << "ℹ️ " << chats << " chats, mock services on " << listen_uri
+              << std::endl;
+
+    auto next_report = start + std::chrono::seconds(1);
+    std::uint64_t reported = 0;
+
+    for (auto now = clock_type::now(); keep_running && now < end;
+         now = clock_type::now()) {
+        auto updates = generator.due(now);
+        if (!updates.empty())
+            server->push_updates(std::move(updates));
+
+        if (now >= next_report) {
+            generator.expire(now);
+
+            const std::uint64_t completed = generator.completed();
+            std::cout << (now < measure_from ? "warmup " : "") << "t="
+                      << std::chrono::duration_cast<std::chrono::seconds>(
+                             now - start)
+                             .count()
+                      << "s commands/s=" << completed - reported
+                      << " lost=" << generator.lost() << std::endl;
+
+            reported = completed;
+            next_report += std::chrono::seconds(1);
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    const double seconds =
+        std::chrono::duration<double>(
+            std::min(clock_type::now(), end) - measure_from)
+            .count();
+    const auto &latency_histogram = generator.latency();
+
+    std::cout << "\ncommands: " << generator.completed()
+              << "\nlost: " << generator.lost()
+              << "\nextra sends: " << generator.extra_sends()
+              << "\ncommands/s: "
+              << (seconds > 0 ? generator.completed() / seconds : 0.0)
+              << "\nlatency ms: p50 " << quantile(latency_histogram, 0.5)
+              << ", p90 " << quantile(latency_histogram, 0.9) << ", p99 "
+              << quantile(latency_histogram, 0.99) << ", p99.9 "
+              << quantile(latency_histogram, 0.999) << std::endl;
+}
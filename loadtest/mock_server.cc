@@ -0,0 +1,401 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#include "mock_server.h"
+#include <algorithm>
+#include <iostream>
+
+namespace ohmyarch {
+static const web::http::status_code too_many_requests = 429;
+
+static std::string error_body(web::http::status_code status,
+                              const std::string &description) {
+    return nlohmann::json{{"ok", false},
+                          {"error_code", status},
+                          {"description", description}}
+        .dump();
+}
+
+// A page of jandan comments, 25 of them like the real API. Every fifth
+// picture is a GIF, which the bot sends as a document.
+static std::string jandan_page(bool pictures) {
+    nlohmann::json comments = nlohmann::json::array();
+
+    for (int index = 0; index < 25; ++index) {
+        nlohmann::json comment{{"comment_ID", std::to_string(4000000 + index)},
+                               {"vote_positive", "100"},
+                               {"vote_negative", "10"}};
+        if (pictures)
+            comment["pics"] = {"http://mock.invalid/mw600/" +
+                               std::to_string(index) +
+                               (index % 5 == 4 ? ".gif" : ".jpg")};
+        else
+            comment["text_content"] = "段子 #" + std::to_string(index) +
+                                      "：程序员的三大美德是懒惰、急躁和傲慢。";
+
+        comments.push_back(std::move(comment));
+    }
+
+    return nlohmann::json{{"status", "ok"}, {"comments", std::move(comments)}}
+        .dump();
+}
+
+mock_server::mock_server(const options &options, send_handler on_send)
+    : options_(options), on_send_(std::move(on_send)),
+      engine_(std::random_device()()),
+      timer_thread_(&mock_server::run_timers, this),
+      listener_(options.listen_uri) {
+    listener_.support([this](web::http::http_request request) {
+        receive(std::move(request));
+    });
+
+    try {
+        listener_.open().wait();
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> guard(timer_mutex_);
+            stopping_ = true;
+        }
+        timer_condition_.notify_one();
+        timer_thread_.join();
+
+        throw;
+    }
+}
+
+mock_server::~mock_server() {
+    try {
+        listener_.close().wait();
+    } catch (const std::exception &error) {
+        std::cerr << "❌ mock_server: " << error.what() << std::endl;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(timer_mutex_);
+        stopping_ = true;
+    }
+    timer_condition_.notify_one();
+    timer_thread_.join();
+}
+
+void mock_server::push_updates(std::vector<nlohmann::json> updates) {
+    std::vector<std::pair<web::http::http_request, std::string>> replies;
+
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+
+        for (auto &update : updates) {
+            update["update_id"] = next_update_id_++;
+            updates_.push_back(std::move(update));
+        }
+
+        for (const auto &poll : polls_)
+            replies.emplace_back(poll.second.request,
+                                 take_updates(poll.second.limit));
+        polls_.clear();
+    }
+
+    for (auto &reply : replies)
+        reply.first.reply(web::http::status_codes::OK, reply.second,
+                          "application/json");
+}
+
+void mock_server::receive(web::http::http_request request) {
+    const web::uri uri = request.relative_uri();
+
+    request.extract_string(true).then(
+        [this, request, uri](pplx::task<std::string> body_task) {
+            std::string body;
+            try {
+                body = body_task.get();
+            } catch (const std::exception &) {
+                request.reply(web::http::status_codes::BadRequest);
+
+                return;
+            }
+
+            const std::string &path = uri.path();
+
+            if (path.compare(0, 4, "/bot") == 0) {
+                const auto slash = path.find('/', 4);
+                if (slash != std::string::npos) {
+                    try {
+                        telegram(request, path.substr(slash + 1), body);
+                    } catch (const std::exception &error) {
+                        request.reply(
+                            web::http::status_codes::BadRequest,
+                            error_body(web::http::status_codes::BadRequest,
+                                       std::string("Bad Request: ") +
+                                           error.what()),
+                            "application/json");
+                    }
+
+                    return;
+                }
+            } else if (path == "/compile") {
+                reply(request, web::http::status_codes::OK,
+                      "Hello, world!\n", "text/plain");
+
+                return;
+            } else if (path.compare(0, 9, "/api/1.0/") == 0) {
+                static const std::string quote =
+                    nlohmann::json{{"quoteText", "Talk is cheap. Show me the "
+                                                 "code."},
+                                   {"quoteAuthor", "Linus Torvalds"}}
+                        .dump();
+
+                reply(request, web::http::status_codes::OK, quote);
+
+                return;
+            } else if (uri.query().find("oxwlxojflwblxbsapi=") !=
+                       std::string::npos) {
+                static const std::string jokes = jandan_page(false);
+                static const std::string pictures = jandan_page(true);
+
+                reply(request, web::http::status_codes::OK,
+                      uri.query().find("get_duan_comments") !=
+                              std::string::npos
+                          ? jokes
+                          : pictures);
+
+                return;
+            }
+
+            request.reply(web::http::status_codes::NotFound);
+        });
+}
+
+void mock_server::telegram(web::http::http_request request,
+                           const std::string &method,
+                           const std::string &body) {
+    const nlohmann::json json =
+        body.empty() ? nlohmann::json::object()
+                     : nlohmann::json::parse(body, nullptr, false);
+    if (!json.is_object()) {
+        request.reply(web::http::status_codes::BadRequest,
+                      error_body(web::http::status_codes::BadRequest,
+                                 "Bad Request: can't parse JSON"),
+                      "application/json");
+
+        return;
+    }
+
+    if (method == "getUpdates") {
+        get_updates(std::move(request), json);
+
+        return;
+    }
+
+    if (method == "getMe") {
+        reply(request, web::http::status_codes::OK,
+              R"({"ok":true,"result":{"id":1,"is_bot":true,)"
+              R"("first_name":"mock","username":"ohmyarch_bot"}})");
+
+        return;
+    }
+
+    if (method == "setWebhook" || method == "deleteWebhook") {
+        reply(request, web::http::status_codes::OK,
+              R"({"ok":true,"result":true})");
+
+        return;
+    }
+
+    if (method != "sendMessage" && method != "sendDocument" &&
+        method != "sendPhoto" && method != "sendMediaGroup" &&
+        method != "editMessageText") {
+        reply(request, web::http::status_codes::NotFound,
+              error_body(web::http::status_codes::NotFound,
+                         "Not Found: method not found"));
+
+        return;
+    }
+
+    const auto chat_id = json.value("chat_id", std::int64_t(0));
+
+    if (chance(options_.throttle_rate)) {
+        const std::string description =
+            "Too Many Requests: retry after " +
+            std::to_string(options_.retry_after);
+        const nlohmann::json response{
+            {"ok", false},
+            {"error_code", too_many_requests},
+            {"description", description},
+            {"parameters", {{"retry_after", options_.retry_after}}}};
+
+        reply(request, too_many_requests, response.dump());
+
+        return;
+    }
+
+    const std::size_t count =
+        method == "sendMediaGroup" && json.count("media") != 0
+            ? std::max<std::size_t>(json.at("media").size(), 1)
+            : 1;
+
+    nlohmann::json messages = nlohmann::json::array();
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+
+        for (std::size_t index = 0; index < count; ++index)
+            messages.push_back(
+                {{"message_id", ++message_id_},
+                 {"chat", {{"id", chat_id}, {"type", "private"}}},
+                 {"date", 0}});
+    }
+
+    const nlohmann::json result{
+        {"ok", true},
+        {"result", method == "sendMediaGroup" ? messages : messages.front()}};
+
+    reply(request, web::http::status_codes::OK, result.dump(),
+          "application/json", [this, chat_id] { on_send_(chat_id); });
+}
+
+void mock_server::get_updates(web::http::http_request request,
+                              const nlohmann::json &body) {
+    const auto offset = body.value("offset", std::int64_t(0));
+    const auto limit = body.value("limit", std::int64_t(100));
+    const auto timeout = body.value("timeout", std::int64_t(0));
+
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    // Like Telegram, an offset confirms every update before it.
+    while (!updates_.empty() &&
+           updates_.front().at("update_id").get<std::int64_t>() < offset)
+        updates_.pop_front();
+
+    if (!updates_.empty() || timeout <= 0) {
+        const std::string result = take_updates(limit);
+        lock.unlock();
+
+        request.reply(web::http::status_codes::OK, result, "application/json");
+
+        return;
+    }
+
+    const std::uint64_t id = next_poll_++;
+    polls_.emplace(id, poll{std::move(request), limit});
+    lock.unlock();
+
+    at(std::chrono::steady_clock::now() + std::chrono::seconds(timeout),
+       [this, id] {
+           std::unique_lock<std::mutex> lock(mutex_);
+
+           const auto iterator = polls_.find(id);
+           if (iterator == polls_.end())
+               return;
+
+           web::http::http_request request = iterator->second.request;
+           polls_.erase(iterator);
+           lock.unlock();
+
+           request.reply(web::http::status_codes::OK,
+                         R"({"ok":true,"result":[]})", "application/json");
+       });
+}
+
+std::string mock_server::take_updates(std::int64_t limit) const {
+    std::string result = R"({"ok":true,"result":[)";
+
+    std::int64_t count = 0;
+    for (const auto &update : updates_) {
+        if (count == limit)
+            break;
+
+        if (count++ != 0)
+            result += ',';
+        result += update.dump();
+    }
+
+    result += "]}";
+
+    return result;
+}
+
+void mock_server::reply(web::http::http_request request,
+                        web::http::status_code status, std::string body,
+                        std::string content_type,
+                        std::function<void()> on_sent) {
+    const bool failed = chance(options_.error_rate);
+
+    auto delay = options_.latency;
+    if (options_.jitter.count() > 0) {
+        std::lock_guard<std::mutex> guard(random_mutex_);
+
+        delay += std::chrono::milliseconds(
+            std::uniform_int_distribution<std::int64_t>(
+                0, options_.jitter.count())(engine_));
+    }
+
+    at(std::chrono::steady_clock::now() + delay,
+       [request, status, body, content_type, on_sent, failed]() mutable {
+           if (failed) {
+               request.reply(web::http::status_codes::InternalError,
+                             error_body(web::http::status_codes::InternalError,
+                                        "Internal Server Error"),
+                             "application/json");
+
+               return;
+           }
+
+           request.reply(status, body, content_type);
+
+           if (on_sent)
+               on_sent();
+       });
+}
+
+void mock_server::at(std::chrono::steady_clock::time_point time,
+                     std::function<void()> action) {
+    {
+        std::lock_guard<std::mutex> guard(timer_mutex_);
+        timers_.emplace(time, std::move(action));
+    }
+
+    timer_condition_.notify_one();
+}
+
+void mock_server::run_timers() {
+    std::unique_lock<std::mutex> lock(timer_mutex_);
+
+    while (!stopping_) {
+        if (timers_.empty()) {
+            timer_condition_.wait(lock);
+
+            continue;
+        }
+
+        const auto first = timers_.begin();
+        if (first->first > std::chrono::steady_clock::now()) {
+            timer_condition_.wait_until(lock, first->first);
+
+            continue;
+        }
+
+        auto action = std::move(first->second);
+        timers_.erase(first);
+        lock.unlock();
+
+        try {
+            action();
+        } catch (const std::exception &error) {
+            std::cerr << "❌ mock_server: " << error.what() << std::endl;
+        }
+
+        lock.lock();
+    }
+}
+
+bool mock_server::chance(double rate) {
+    if (rate <= 0.0)
+        return false;
+
+    std::lock_guard<std::mutex> guard(random_mutex_);
+
+    return std::bernoulli_distribution(rate)(engine_);
+}
+}
@@ -0,0 +1,109 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cpprest/http_listener.h>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace ohmyarch {
+// Stands in for every service the bot calls, on one listener: the Bot API
+// under /bot<token>/, jandan under /?oxwlxojflwblxbsapi=, forismatic under
+// /api/1.0/ and coliru under /compile. Point telegram_uri, jandan_uri,
+// forismatic_uri and coliru_uri of the bot at listen_uri.
+//
+// getUpdates long-polls the updates queued with push_updates(). Every other
+// reply is held back by latency plus up to jitter, and fails with a 500 at
+// error_rate; Bot API sends are also refused with a 429 and retry_after at
+// throttle_rate.
+class mock_server {
+  public:
+    struct options {
+        std::string listen_uri;
+        std::chrono::milliseconds latency;
+        std::chrono::milliseconds jitter;
+        double error_rate;
+        double throttle_rate;
+        std::int32_t retry_after;
+    };
+
+    // Called with the chat of every send that succeeded, when its reply goes
+    // out.
+    using send_handler = std::function<void(std::int64_t chat_id)>;
+
+    // Throws if the listener can't be opened.
+    mock_server(const options &options, send_handler on_send);
+    ~mock_server();
+
+    mock_server(const mock_server &) = delete;
+    mock_server &operator=(const mock_server &) = delete;
+
+    // Queues updates for getUpdates, numbering them from the last update_id
+    // on, and answers the pending poll.
+    void push_updates(std::vector<nlohmann::json> updates);
+
+  private:
+    struct poll {
+        web::http::http_request request;
+        std::int64_t limit;
+    };
+
+    void receive(web::http::http_request request);
+    void telegram(web::http::http_request request, const std::string &method,
+                  const std::string &body);
+    void get_updates(web::http::http_request request,
+                     const nlohmann::json &body);
+
+    // Replies after latency plus up to jitter, or with a 500 at error_rate.
+    void reply(web::http::http_request request,
+               web::http::status_code status, std::string body,
+               std::string content_type = "application/json",
+               std::function<void()> on_sent = {});
+
+    // Up to limit of the queued updates as a getUpdates response. Called with
+    // mutex_ held.
+    std::string take_updates(std::int64_t limit) const;
+
+    void at(std::chrono::steady_clock::time_point time,
+            std::function<void()> action);
+    void run_timers();
+
+    bool chance(double rate);
+
+    const options options_;
+    const send_handler on_send_;
+
+    // Guards updates_, polls_ and the counters.
+    std::mutex mutex_;
+    std::deque<nlohmann::json> updates_;
+    std::int64_t next_update_id_ = 1;
+    std::map<std::uint64_t, poll> polls_;
+    std::uint64_t next_poll_ = 0;
+    std::int64_t message_id_ = 0;
+
+    std::mutex random_mutex_;
+    std::mt19937_64 engine_;
+
+    // Delayed replies and poll timeouts, run on timer_thread_.
+    std::mutex timer_mutex_;
+    std::condition_variable timer_condition_;
+    std::multimap<std::chrono::steady_clock::time_point, std::function<void()>>
+        timers_;
+    bool stopping_ = false;
+    std::thread timer_thread_;
+
+    web::http::experimental::listener::http_listener listener_;
+};
+}
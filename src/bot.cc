@@ -0,0 +1,27 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#include "bot.h"
+#include "config.h"
+
+namespace ohmyarch {
+bot::bot(std::size_t index, const options &options)
+    : index_(index), options_(options), path_("bot" + options.token + '/') {
+    if (options.update_offset_path.empty())
+        return;
+
+    offsets_.reset(new offset_store(options.update_offset_path,
+                                    update_offset_sync_interval));
+    update_offset_ = offsets_->offset();
+}
+
+void bot::advance_update_offset(std::int32_t offset) {
+    update_offset_ = offset;
+
+    if (offsets_)
+        offsets_->advance(offset);
+}
+}
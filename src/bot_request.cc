@@ -0,0 +1,121 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#include "bot_request.h"
+
+namespace ohmyarch {
+bot_request::bot_request(std::size_t size_hint) {
+    // Some room for escapes on top of the hint.
+    body_.reserve(size_hint + size_hint / 8 + 16);
+    body_ += '{';
+}
+
+bot_request &bot_request::field(boost::string_view name, std::int64_t value) {
+    separate();
+    write_string(name);
+    body_ += ':';
+    body_ += std::to_string(value);
+
+    return *this;
+}
+
+bot_request &bot_request::field(boost::string_view name,
+                                boost::string_view value) {
+    separate();
+    write_string(name);
+    body_ += ':';
+    write_string(value);
+
+    return *this;
+}
+
+bot_request &bot_request::begin_array(boost::string_view name) {
+    separate();
+    write_string(name);
+    body_ += ":[";
+
+    return *this;
+}
+
+bot_request &bot_request::element(boost::string_view value) {
+    separate();
+    write_string(value);
+
+    return *this;
+}
+
+bot_request &bot_request::begin_object() {
+    separate();
+    body_ += '{';
+
+    return *this;
+}
+
+bot_request &bot_request::end_object() {
+    body_ += '}';
+
+    return *this;
+}
+
+bot_request &bot_request::end_array() {
+    body_ += ']';
+
+    return *this;
+}
+
+web::http::http_request
+bot_request::to_http_request(const std::string &method) {
+    body_ += '}';
+
+    web::http::http_request request(web::http::methods::POST);
+    request.set_request_uri(method);
+    request.set_body(std::move(body_), "application/json");
+
+    return request;
+}
+
+void bot_request::separate() {
+    const char last = body_.back();
+    if (last != '{' && last != '[')
+        body_ += ',';
+}
+
+void bot_request::write_string(boost::string_view value) {
+    static const char hex[] = "0123456789abcdef";
+
+    body_ += '"';
+
+    for (const char c : value)
+        switch (c) {
+        case '"':
+            body_ += "\\\"";
+            break;
+        case '\\':
+            body_ += "\\\\";
+            break;
+        case '\n':
+            body_ += "\\n";
+            break;
+        case '\r':
+            body_ += "\\r";
+            break;
+        case '\t':
+            body_ += "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                body_ += "\\u00";
+                body_ += hex[c >> 4];
+                body_ += hex[c & 0xf];
+            } else {
+                body_ += c;
+            }
+            break;
+        }
+
+    body_ += '"';
+}
+}
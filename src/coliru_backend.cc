@@ -0,0 +1,63 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#include "config.h"
+#include "run_cpp_backend.h"
+#include "upstream_guard.h"
+#include <cpprest/http_client.h>
+#include <spdlog/spdlog.h>
+
+namespace ohmyarch {
+const std::string &coliru_backend::command() const {
+    static const std::string command =
+        "g++ -std=c++1z -fconcepts -fgnu-tm -O3 -Wall -Wextra "
+        "-pedantic-errors main.cpp -pthread -lm -latomic -lstdc++fs && "
+        "./a.out";
+
+    return command;
+}
+
+pplx::task<std::experimental::optional<run_cpp_output>>
+coliru_backend::run(const std::string &code, pplx::cancellation_token token) {
+    web::json::value body_data;
+    body_data["cmd"] = web::json::value::string(command());
+    body_data["src"] = web::json::value::string(code);
+
+    web::http::http_request request(web::http::methods::POST);
+    request.set_request_uri("/compile");
+    request.set_body(body_data);
+
+    return guarded_request(upstream::coliru, coliru_uri, std::move(request),
+                           token)
+        .then([](web::http::http_response response)
+                  -> std::experimental::optional<run_cpp_output> {
+            // An error page of coliru's isn't the snippet's output.
+            const auto status = response.status_code();
+            if (status < 200 || status >= 300) {
+                spdlog::get("logger")->error("❌ coliru_backend: HTTP {}",
+                                             status);
+
+                return {};
+            }
+
+            // pooled_request() has waited for the body already.
+            return run_cpp_output{response.extract_string().get(), true};
+        })
+        .then([](pplx::task<std::experimental::optional<run_cpp_output>>
+                     output) -> std::experimental::optional<run_cpp_output> {
+            try {
+                return output.get();
+            } catch (const pplx::task_canceled &) {
+                return {};
+            } catch (const std::exception &error) {
+                spdlog::get("logger")->error("❌ coliru_backend: {}",
+                                             error.what());
+
+                return {};
+            }
+        });
+}
+}
@@ -0,0 +1,79 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#include "command.h"
+
+namespace ohmyarch {
+// FNV-1a, with the seed mixed into the offset basis.
+static std::uint32_t hash(boost::string_view text, std::uint32_t seed) {
+    std::uint32_t value = 2166136261u ^ seed;
+    for (const char c : text) {
+        value ^= static_cast<unsigned char>(c);
+        value *= 16777619u;
+    }
+
+    return value;
+}
+
+command_registry::command_registry(const std::string &username) {
+    const std::pair<const char *, bot_command> commands[] = {
+        {"quote", bot_command::quote},
+        {"joke", bot_command::joke},
+        {"funny_pics", bot_command::funny_pics},
+        {"girl_pics", bot_command::girl_pics},
+        {"run_cpp", bot_command::run_cpp},
+        {"about", bot_command::about}};
+
+    for (const auto &command : commands) {
+        const std::string text = std::string("/") + command.first;
+
+        entries_.push_back({text, command.second});
+        entries_.push_back({text + '@' + username, command.second});
+    }
+
+    // With four slots per key a collision-free seed turns up within a few
+    // tries; grow the table if it doesn't.
+    std::size_t size = 1;
+    while (size < entries_.size() * 4)
+        size <<= 1;
+
+    for (seed_ = 0;; ++seed_) {
+        if (seed_ != 0 && seed_ % 1024 == 0)
+            size <<= 1;
+
+        slots_.assign(size, 0);
+
+        bool collision = false;
+
+        for (std::size_t i = 0; i < entries_.size(); ++i) {
+            auto &slot = slots_[hash(entries_[i].text, seed_) & (size - 1)];
+            if (slot != 0) {
+                collision = true;
+
+                break;
+            }
+
+            slot = static_cast<std::uint8_t>(i + 1);
+        }
+
+        if (!collision)
+            break;
+    }
+}
+
+std::experimental::optional<bot_command>
+command_registry::find(boost::string_view text) const {
+    const std::uint8_t slot = slots_[hash(text, seed_) & (slots_.size() - 1)];
+    if (slot == 0)
+        return {};
+
+    const auto &entry = entries_[slot - 1];
+    if (entry.text != text)
+        return {};
+
+    return entry.command;
+}
+}
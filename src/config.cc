@@ -5,8 +5,75 @@
 //
 
 #include "config.h"
+#include <algorithm>
+#include <thread>
 
 namespace ohmyarch {
-std::string api_uri;
+std::string telegram_uri = "https://api.telegram.org/";
+std::string jandan_uri = "http://i.jandan.net/";
+std::string forismatic_uri = "http://api.forismatic.com/";
+std::string coliru_uri = "http://coliru.stacked-crooked.com/";
+
+std::vector<bot::options> bots;
+
 web::http::client::http_client_config client_config;
+
+std::int32_t polling_timeout = 30;
+std::int32_t polling_limit = 100;
+web::http::client::http_client_config polling_client_config;
+
+std::chrono::milliseconds update_offset_sync_interval(1000);
+
+std::chrono::seconds stale_update_age(300);
+stale_update_policy stale_policy = stale_update_policy::collapse;
+
+std::size_t max_connections_per_host = 8;
+std::chrono::seconds connection_idle_timeout(60);
+
+std::size_t worker_threads = std::max(4u, std::thread::hardware_concurrency());
+
+std::size_t queue_capacity = 100;
+overload_policy queue_overload_policy = overload_policy::drop_newest;
+
+std::size_t prefetch_capacity = 100;
+std::size_t prefetch_low_watermark = 25;
+std::chrono::seconds prefetch_ttl(3600);
+
+std::size_t run_cpp_cache_capacity = 1000;
+std::chrono::seconds run_cpp_cache_ttl(7 * 24 * 3600);
+std::string run_cpp_cache_path;
+
+std::string run_cpp_backend_name = "coliru";
+local_backend::options local_backend_options{
+    "g++",
+    {"-std=c++17", "-O2", "-Wall", "-Wextra", "-pedantic-errors", "-pthread"},
+    "/tmp/ohmyarch_bot",
+    4,
+    {std::chrono::seconds(10), 10, 2048ull << 20, 256ull << 20, 64 << 10, 16},
+    {std::chrono::seconds(5), 3, 512ull << 20, 16ull << 20, 64 << 10, 32},
+    {"/bin", "/etc/alternatives", "/etc/ld.so.cache", "/lib", "/lib32",
+     "/lib64", "/libx32", "/usr"}};
+
+std::int32_t webhook_max_connections = 40;
+
+std::string metrics_listen;
+
+std::size_t shard_workers = 0;
+
+upstream_policy upstream_policies[upstream_count] = {
+    {std::chrono::milliseconds(0), false},
+    {std::chrono::milliseconds(0), false},
+    {std::chrono::milliseconds(10000), false},
+    {std::chrono::milliseconds(5000), false},
+    {std::chrono::milliseconds(30000), false},
+    {std::chrono::milliseconds(0), false}};
+std::chrono::milliseconds hedge_min_delay(50);
+circuit_breaker_limits breaker_limits{20, 0.5, std::chrono::seconds(30)};
+
+double trace_sample_rate = 0.0;
+std::size_t trace_buffer_spans = 4096;
+std::string trace_path = "/tmp/ohmyarch_bot_trace.json";
+trace_format trace_file_format = trace_format::chrome;
+
+send_scheduler::limits send_limits{30.0, 1.0, 20.0 / 60.0, 3};
 }
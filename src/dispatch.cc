@@ -0,0 +1,183 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#include "dispatch.h"
+#include <boost/algorithm/string/replace.hpp>
+#include <boost/functional/hash.hpp>
+#include <unordered_set>
+
+namespace ohmyarch {
+std::size_t queued_command::signature() const {
+    std::size_t seed = static_cast<std::size_t>(command_) + 1;
+    if (ticket_) {
+        boost::hash_combine(seed, ticket_->message_id);
+        boost::hash_combine(seed, ticket_->generation);
+    }
+    boost::hash_combine(seed, code_);
+
+    return seed == 0 ? 1 : seed;
+}
+
+std::experimental::optional<std::string>
+extract_code(const std::vector<message_entity> &entities,
+             utf16_cursor &cursor) {
+    if (entities.size() < 2)
+        return {};
+
+    std::string code;
+
+    for (std::size_t index = 1; index < entities.size(); ++index) {
+        const auto &code_entity = entities[index];
+        if (code_entity.type() != entity_type::code &&
+            code_entity.type() != entity_type::pre)
+            return {};
+
+        const auto slice =
+            cursor.slice(code_entity.offset(), code_entity.length());
+        code.append(slice.data(), slice.size());
+        code += '\n';
+    }
+
+    return code;
+}
+
+void stale_backlog::collapse(std::vector<chat_command> &result,
+                             const std::vector<bool> &stale, bool any_stale) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (!any_stale) {
+        seen_.clear();
+        return;
+    }
+
+    // Walked newest first, so the newest of each kind in the batch is kept,
+    // unless an earlier batch already ran one.
+    std::unordered_set<command_key, boost::hash<command_key>> batch;
+    std::vector<bool> keep(result.size(), true);
+
+    for (std::size_t index = result.size(); index-- != 0;) {
+        if (!stale[index])
+            continue;
+
+        const command_key key(result[index].chat_id,
+                              result[index].command.command());
+        keep[index] = seen_.count(key) == 0 && batch.insert(key).second;
+    }
+    seen_.insert(batch.begin(), batch.end());
+
+    std::size_t kept = 0;
+    for (std::size_t index = 0; index < result.size(); ++index)
+        if (keep[index]) {
+            if (kept != index)
+                result[kept] = std::move(result[index]);
+            ++kept;
+        }
+
+    result.erase(result.begin() + kept, result.end());
+}
+
+std::vector<chat_command> collect_commands(const command_registry &commands,
+                                           run_cpp_jobs &jobs,
+                                           const update_batch &updates,
+                                           stale_update_policy stale_policy,
+                                           std::int64_t stale_before,
+                                           stale_backlog *backlog) {
+    std::vector<chat_command> result;
+    // Whether each command in result is stale.
+    std::vector<bool> stale;
+    bool any_stale = false;
+
+    for (const auto &update : updates) {
+        const auto &message = update.message();
+        const auto &edited_message = update.edited_message();
+
+        const auto &any_message = message ? message : edited_message;
+        const bool is_stale = stale_policy != stale_update_policy::process &&
+                              any_message &&
+                              any_message->date() < stale_before;
+        any_stale = any_stale || is_stale;
+        if (is_stale && stale_policy == stale_update_policy::skip)
+            continue;
+
+        if (message) {
+            const auto &entities = message->entities();
+            const std::int64_t chat_id = message->chat().id();
+            utf16_cursor cursor(message->text());
+
+            for (const auto &entity : entities) {
+                if (entity.type() != entity_type::bot_command)
+                    continue;
+
+                const auto command = commands.find(
+                    cursor.slice(entity.offset(), entity.length()));
+                if (!command)
+                    continue;
+
+                if (command.value() != bot_command::run_cpp) {
+                    result.push_back({chat_id, command.value()});
+
+                    continue;
+                }
+
+                // /run_cpp has to start the message, and the rest of it is
+                // code.
+                if (entity.offset() == 0) {
+                    auto code = extract_code(entities, cursor);
+                    if (code)
+                        result.push_back(
+                            {chat_id,
+                             {jobs.start(chat_id, message->id()),
+                              std::move(code.value())}});
+
+                    break;
+                }
+            }
+        } else if (edited_message) {
+            const auto &entities = edited_message->entities();
+            if (entities.empty())
+                continue;
+
+            const auto &command_entity = entities.front();
+            if (command_entity.offset() != 0 ||
+                command_entity.type() != entity_type::bot_command)
+                continue;
+
+            utf16_cursor cursor(edited_message->text());
+            const auto command =
+                commands.find(cursor.slice(0, command_entity.length()));
+            if (!command || command.value() != bot_command::run_cpp)
+                continue;
+
+            auto code = extract_code(entities, cursor);
+            if (!code)
+                continue;
+
+            const std::int64_t chat_id = edited_message->chat().id();
+
+            // Supersedes the run of the previous version, queued or in
+            // flight.
+            result.push_back({chat_id,
+                              {jobs.start(chat_id, edited_message->id()),
+                               std::move(code.value())}});
+        }
+
+        stale.resize(result.size(), is_stale);
+    }
+
+    if (stale_policy == stale_update_policy::collapse) {
+        stale_backlog batch;
+        (backlog ? *backlog : batch).collapse(result, stale, any_stale);
+    }
+
+    return result;
+}
+
+std::string format_run_cpp_output(std::string output) {
+    boost::replace_all(output, "\n", "`\n`");
+
+    return '`' + output + '`';
+}
+}
@@ -0,0 +1,257 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#include "executor.h"
+#include <spdlog/spdlog.h>
+
+namespace ohmyarch {
+executor::executor(std::size_t threads, std::size_t queue_capacity,
+                   overload_policy policy)
+    : queue_capacity_(queue_capacity), policy_(policy) {
+    if (threads == 0)
+        threads = 1;
+
+    for (std::size_t i = 0; i < threads; ++i)
+        workers_.emplace_back(new worker);
+
+    for (std::size_t i = 0; i < threads; ++i)
+        workers_[i]->thread = std::thread(&executor::run, this, i);
+}
+
+executor::~executor() {
+    stopping_ = true;
+
+    for (auto &worker : workers_) {
+        // Taking the lock makes sure a worker can't miss the notification
+        // between checking stopping_ and going to sleep.
+        { std::lock_guard<std::mutex> guard(worker->mutex); }
+        worker->condition.notify_one();
+    }
+
+    for (auto &worker : workers_)
+        worker->thread.join();
+
+    std::unique_lock<std::mutex> lock(strands_mutex_);
+    idle_.wait(lock, [this] { return in_flight_ == 0; });
+}
+
+bool executor::post(std::int64_t key, std::function<pplx::task<void>()> task,
+                    std::size_t signature) {
+    std::shared_ptr<strand> to_schedule;
+
+    {
+        std::lock_guard<std::mutex> guard(strands_mutex_);
+
+        auto &strand = strands_[key];
+        if (!strand) {
+            strand = std::make_shared<executor::strand>(queue_capacity_,
+                                                        policy_, statistics_);
+            strand->key = key;
+            strand->home = std::hash<std::int64_t>()(key) % workers_.size();
+        }
+
+        if (!strand->tasks.push({std::move(task), signature}))
+            return false;
+
+        if (!strand->scheduled) {
+            strand->scheduled = true;
+            to_schedule = strand;
+        }
+    }
+
+    if (to_schedule) {
+        const std::size_t home = to_schedule->home;
+        enqueue(home, std::move(to_schedule));
+    }
+
+    return true;
+}
+
+std::size_t executor::queued() const {
+    std::lock_guard<std::mutex> guard(strands_mutex_);
+
+    std::size_t queued = 0;
+    for (const auto &strand : strands_)
+        queued += strand.second->tasks.size();
+
+    return queued;
+}
+
+std::size_t executor::active_keys() const {
+    std::lock_guard<std::mutex> guard(strands_mutex_);
+
+    return strands_.size();
+}
+
+// A strand queued on a busy worker wakes a parked sibling so that it can
+// steal the work.
+void executor::enqueue(std::size_t index, std::shared_ptr<strand> strand) {
+    auto &worker = *workers_[index];
+
+    bool parked;
+
+    {
+        std::lock_guard<std::mutex> guard(worker.mutex);
+        worker.ready.emplace_back(std::move(strand));
+        parked = worker.parked;
+    }
+
+    if (parked)
+        worker.condition.notify_one();
+    else
+        wake_sibling(index);
+}
+
+void executor::wake_sibling(std::size_t index) {
+    const std::size_t size = workers_.size();
+
+    for (std::size_t i = 1; i < size; ++i) {
+        auto &sibling = *workers_[(index + i) % size];
+
+        std::unique_lock<std::mutex> lock(sibling.mutex);
+        if (sibling.parked && !sibling.wake) {
+            sibling.wake = true;
+            lock.unlock();
+            sibling.condition.notify_one();
+
+            return;
+        }
+    }
+}
+
+std::shared_ptr<executor::strand> executor::pop(std::size_t index) {
+    auto &worker = *workers_[index];
+
+    std::lock_guard<std::mutex> guard(worker.mutex);
+    if (worker.ready.empty())
+        return {};
+
+    auto strand = std::move(worker.ready.front());
+    worker.ready.pop_front();
+
+    return strand;
+}
+
+std::shared_ptr<executor::strand> executor::steal(std::size_t thief) {
+    const std::size_t size = workers_.size();
+
+    for (std::size_t i = 1; i < size; ++i) {
+        auto &victim = *workers_[(thief + i) % size];
+
+        std::lock_guard<std::mutex> guard(victim.mutex);
+        if (!victim.ready.empty()) {
+            auto strand = std::move(victim.ready.back());
+            victim.ready.pop_back();
+
+            return strand;
+        }
+    }
+
+    return {};
+}
+
+void executor::run(std::size_t index) {
+    while (!stopping_) {
+        auto strand = pop(index);
+        if (!strand)
+            strand = steal(index);
+        if (!strand)
+            strand = park(index);
+
+        if (strand)
+            execute(strand);
+    }
+}
+
+// The worker is marked parked before it looks at its siblings one last time,
+// so a strand enqueued anywhere after that look either lands on its own queue
+// or wakes it through wake_sibling().
+std::shared_ptr<executor::strand> executor::park(std::size_t index) {
+    auto &worker = *workers_[index];
+
+    {
+        std::lock_guard<std::mutex> guard(worker.mutex);
+        worker.parked = true;
+    }
+
+    auto strand = steal(index);
+
+    std::unique_lock<std::mutex> lock(worker.mutex);
+
+    if (!strand) {
+        worker.condition.wait(lock, [this, &worker] {
+            return !worker.ready.empty() || worker.wake || stopping_;
+        });
+
+        if (!worker.ready.empty()) {
+            strand = std::move(worker.ready.front());
+            worker.ready.pop_front();
+        }
+    }
+
+    worker.parked = false;
+    worker.wake = false;
+
+    return strand;
+}
+
+// Starts one task of the strand. Once it completes the strand goes back to
+// the end of its home worker's queue if it has more, so that a busy chat
+// can't starve the others.
+void executor::execute(const std::shared_ptr<strand> &strand) {
+    {
+        std::lock_guard<std::mutex> guard(strands_mutex_);
+        ++in_flight_;
+    }
+
+    // Only one task of a strand runs at a time, and a scheduled strand is
+    // never empty.
+    auto job = strand->tasks.pop();
+
+    pplx::task<void> task;
+
+    try {
+        task = job->task();
+    } catch (const std::exception &error) {
+        spdlog::get("logger")->error("❌ executor: {}", error.what());
+
+        task = pplx::task_from_result();
+    }
+
+    task.then([this, strand](pplx::task<void> task) {
+        try {
+            task.get();
+        } catch (const std::exception &error) {
+            spdlog::get("logger")->error("❌ executor: {}", error.what());
+        }
+
+        finish(strand);
+    });
+}
+
+void executor::finish(const std::shared_ptr<strand> &strand) {
+    bool more;
+
+    {
+        std::lock_guard<std::mutex> guard(strands_mutex_);
+
+        more = !strand->tasks.empty() && !stopping_;
+        if (!more) {
+            strand->scheduled = false;
+            strands_.erase(strand->key);
+        }
+    }
+
+    if (more)
+        enqueue(strand->home, strand);
+
+    // Notifying under the lock keeps the destructor from returning before
+    // we are done with this.
+    std::lock_guard<std::mutex> guard(strands_mutex_);
+    if (--in_flight_ == 0)
+        idle_.notify_all();
+}
+}
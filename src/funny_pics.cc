@@ -4,7 +4,10 @@
 // license information.
 //
 
+#include "config.h"
 #include "funny_pics.h"
+#include "prefetch_pool.h"
+#include "upstream_guard.h"
 #include <cpprest/http_client.h>
 #include <nlohmann/json.hpp>
 #include <spdlog/spdlog.h>
@@ -12,56 +15,72 @@
 namespace ohmyarch {
 static std::mt19937_64 engine((std::random_device().operator()()));
 
-std::experimental::optional<std::vector<std::string>> get_funny_pics() {
+// Returns the pictures of every comment on a random page that passes the vote
+// filter.
+static pplx::task<std::vector<std::vector<std::string>>> fetch_funny_pics() {
     std::uniform_int_distribution<int> gen_page_index(1, 64);
 
-    web::uri_builder builder(
-        "http://i.jandan.net/?oxwlxojflwblxbsapi=jandan.get_pic_comments");
+    web::uri_builder builder("/?oxwlxojflwblxbsapi=jandan.get_pic_comments");
     builder.append_query("page", gen_page_index(engine));
 
-    web::http::client::http_client client(builder.to_uri());
+    web::http::http_request request(web::http::methods::GET);
+    request.set_request_uri(builder.to_uri());
 
-    try {
-        nlohmann::json json =
-            nlohmann::json::parse(client.request(web::http::methods::GET)
-                                      .get()
-                                      .extract_string()
-                                      .get());
+    return guarded_request(upstream::jandan, jandan_uri, std::move(request))
+        .then([](web::http::http_response response) {
+            return response.extract_string();
+        })
+        .then([](std::string body) {
+            nlohmann::json json = nlohmann::json::parse(body);
 
-        if (json.at("status") != "ok")
-            return {};
+            std::vector<std::vector<std::string>> comments;
 
-        std::vector<std::string> pics;
+            if (json.at("status") != "ok")
+                return comments;
 
-        std::uniform_int_distribution<int> gen_comment_index(0, 24);
+            for (auto &comment : json.at("comments")) {
+                const double oo =
+                    std::stod(comment.at("vote_positive")
+                                  .get_ref<const nlohmann::json::string_t &>());
+                const double xx =
+                    std::stod(comment.at("vote_negative")
+                                  .get_ref<const nlohmann::json::string_t &>());
 
-        int comment_index;
+                if ((oo + xx) >= 50.0 && (oo / xx) < 0.618)
+                    continue;
 
-        auto &comments_array = json.at("comments");
+                std::vector<std::string> pics;
 
-        for (int i = 0; i < 25; ++i) {
-            comment_index = gen_comment_index(engine);
-            const auto &comment = comments_array.at(comment_index);
-            const double oo = std::stod(comment.at("vote_positive").get_ref<const nlohmann::json::string_t &>());
-            const double xx = std::stod(comment.at("vote_negative").get_ref<const nlohmann::json::string_t &>());
+                for (auto &pic : comment.at("pics")) {
+                    std::string &pic_uri =
+                        pic.get_ref<nlohmann::json::string_t &>();
+                    pic_uri.replace(
+                        boost::find_nth(pic_uri, "/", 2).begin() + 1,
+                        boost::find_nth(pic_uri, "/", 3).begin(), "large");
 
-            if ((oo + xx) < 50.0 || (oo / xx) >= 0.618)
-                break;
-        }
+                    pics.emplace_back(std::move(pic_uri));
+                }
 
-        for (auto &pic : comments_array.at(comment_index).at("pics")) {
-            std::string &pic_uri = pic.get_ref<nlohmann::json::string_t &>();
-            pic_uri.replace(boost::find_nth(pic_uri, "/", 2).begin() + 1,
-                            boost::find_nth(pic_uri, "/", 3).begin(), "large");
+                if (!pics.empty())
+                    comments.emplace_back(std::move(pics));
+            }
 
-            pics.emplace_back(pic_uri);
-        }
+            return comments;
+        });
+}
+
+static prefetch_pool<std::vector<std::string>> &pool() {
+    static prefetch_pool<std::vector<std::string>> pool(
+        "get_funny_pics", fetch_funny_pics, prefetch_capacity,
+        prefetch_low_watermark, prefetch_ttl);
+
+    return pool;
+}
 
-        return pics;
-    } catch (const std::exception &error) {
-        spdlog::get("logger")->error("❌ get_funny_pics: {}", error.what());
+void prefetch_funny_pics() { pool().refill(); }
 
-        return {};
-    }
+pplx::task<std::experimental::optional<std::vector<std::string>>>
+get_funny_pics() {
+    return pool().take();
 }
 }
@@ -0,0 +1,150 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#include "config.h"
+#include "http_pool.h"
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+namespace ohmyarch {
+namespace {
+struct pool_entry {
+    pool_entry(const std::string &base_uri,
+               const web::http::client::http_client_config &config)
+        : client(base_uri, config) {}
+
+    web::http::client::http_client client;
+    std::size_t in_flight = 0;
+    std::deque<pplx::task_completion_event<void>> waiters;
+    std::chrono::steady_clock::time_point last_used;
+};
+
+std::mutex pool_mutex;
+std::unordered_map<std::string, std::shared_ptr<pool_entry>> pool;
+std::chrono::steady_clock::time_point last_sweep;
+
+std::string
+pool_key(const std::string &base_uri,
+         const web::http::client::http_client_config &config) {
+    std::string key = base_uri;
+    key += '\n';
+    if (config.proxy().is_specified())
+        key += config.proxy().address().to_string();
+    key += '\n';
+    key += std::to_string(config.timeout().count());
+
+    return key;
+}
+
+// Called with pool_mutex held.
+void evict_idle(std::chrono::steady_clock::time_point now) {
+    if (now - last_sweep < connection_idle_timeout)
+        return;
+
+    last_sweep = now;
+
+    for (auto iterator = pool.begin(); iterator != pool.end();)
+        if (iterator->second->in_flight == 0 &&
+            now - iterator->second->last_used >= connection_idle_timeout)
+            iterator = pool.erase(iterator);
+        else
+            ++iterator;
+}
+
+pplx::task<void> acquire(const std::shared_ptr<pool_entry> &entry) {
+    std::lock_guard<std::mutex> guard(pool_mutex);
+
+    entry->last_used = std::chrono::steady_clock::now();
+
+    if (entry->in_flight < max_connections_per_host) {
+        ++entry->in_flight;
+
+        return pplx::task_from_result();
+    }
+
+    pplx::task_completion_event<void> event;
+    entry->waiters.push_back(event);
+
+    return pplx::create_task(event);
+}
+
+void release(const std::shared_ptr<pool_entry> &entry) {
+    pplx::task_completion_event<void> event;
+
+    {
+        std::lock_guard<std::mutex> guard(pool_mutex);
+
+        entry->last_used = std::chrono::steady_clock::now();
+
+        if (entry->waiters.empty()) {
+            --entry->in_flight;
+
+            return;
+        }
+
+        // The slot is handed over to the next waiter as is.
+        event = entry->waiters.front();
+        entry->waiters.pop_front();
+    }
+
+    event.set();
+}
+}
+
+pplx::task<web::http::http_response>
+pooled_request(upstream upstream, const std::string &base_uri,
+               const web::http::client::http_client_config &config,
+               web::http::http_request request,
+               pplx::cancellation_token token) {
+    const auto start = std::chrono::steady_clock::now();
+
+    std::shared_ptr<pool_entry> entry;
+
+    {
+        const std::string key = pool_key(base_uri, config);
+
+        std::lock_guard<std::mutex> guard(pool_mutex);
+
+        evict_idle(std::chrono::steady_clock::now());
+
+        auto &slot = pool[key];
+        if (!slot)
+            slot = std::make_shared<pool_entry>(base_uri, config);
+
+        entry = slot;
+    }
+
+    return acquire(entry)
+        .then([entry, request, token]() mutable {
+            return entry->client.request(request, token);
+        })
+        .then([](web::http::http_response response) {
+            // The connection goes back to the client's pool only after the
+            // body has been read in full.
+            return response.content_ready();
+        })
+        .then([entry, upstream, start,
+               token](pplx::task<web::http::http_response> task) {
+            release(entry);
+
+            if (token.is_canceled())
+                return task;
+
+            bool failed = true;
+            try {
+                const auto status = task.get().status_code();
+                failed = status < 200 || status >= 300;
+            } catch (const std::exception &) {
+            }
+
+            record_upstream(upstream, std::chrono::steady_clock::now() - start,
+                            failed);
+
+            return task;
+        });
+}
+}
@@ -4,7 +4,10 @@
 // license information.
 //
 
+#include "config.h"
 #include "joke.h"
+#include "prefetch_pool.h"
+#include "upstream_guard.h"
 #include <cpprest/http_client.h>
 #include <nlohmann/json.hpp>
 #include <spdlog/spdlog.h>
@@ -12,34 +15,47 @@
 namespace ohmyarch {
 static std::mt19937_64 engine((std::random_device().operator()()));
 
-std::experimental::optional<std::string> get_joke() {
+static pplx::task<std::vector<std::string>> fetch_jokes() {
     std::uniform_int_distribution<int> gen_page_index(1, 300);
 
-    web::uri_builder builder(
-        "http://i.jandan.net/?oxwlxojflwblxbsapi=jandan.get_duan_comments");
+    web::uri_builder builder("/?oxwlxojflwblxbsapi=jandan.get_duan_comments");
     builder.append_query("page", gen_page_index(engine));
 
-    web::http::client::http_client client(builder.to_uri());
+    web::http::http_request request(web::http::methods::GET);
+    request.set_request_uri(builder.to_uri());
 
-    try {
-        nlohmann::json json =
-            nlohmann::json::parse(client.request(web::http::methods::GET)
-                                      .get()
-                                      .extract_string()
-                                      .get());
+    return guarded_request(upstream::jandan, jandan_uri, std::move(request))
+        .then([](web::http::http_response response) {
+            return response.extract_string();
+        })
+        .then([](std::string body) {
+            nlohmann::json json = nlohmann::json::parse(body);
 
-        if (json.at("status") != "ok")
-            return {};
+            std::vector<std::string> jokes;
 
-        std::uniform_int_distribution<int> gen_comment_index(0, 24);
+            if (json.at("status") != "ok")
+                return jokes;
 
-        return json.at("comments")
-            .at(gen_comment_index(engine))
-            .at("text_content");
-    } catch (const std::exception &error) {
-        spdlog::get("logger")->error("❌ get_joke: {}", error.what());
+            for (const auto &comment : json.at("comments"))
+                jokes.emplace_back(
+                    comment.at("text_content").get<std::string>());
 
-        return {};
-    }
+            return jokes;
+        });
+}
+
+static prefetch_pool<std::string> &pool() {
+    static prefetch_pool<std::string> pool("get_joke", fetch_jokes,
+                                           prefetch_capacity,
+                                           prefetch_low_watermark,
+                                           prefetch_ttl);
+
+    return pool;
+}
+
+void prefetch_jokes() { pool().refill(); }
+
+pplx::task<std::experimental::optional<std::string>> get_joke() {
+    return pool().take();
 }
 }
@@ -0,0 +1,540 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#include "local_backend.h"
+#include "metrics.h"
+#include "socket_frames.h"
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <spdlog/spdlog.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace ohmyarch {
+// What most snippets include. Headers of a newer standard than the flags ask
+// for are left out by the guards.
+static const char precompiled_header[] = R"(#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <set>
+#include <sstream>
+#include <stack>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#if __cplusplus >= 201703L
+#include <any>
+#include <optional>
+#include <string_view>
+#include <variant>
+#endif
+)";
+
+static void make_directory(const std::string &path) {
+    if (::mkdir(path.c_str(), 0700) != 0 && errno != EEXIST)
+        throw std::system_error(errno, std::generic_category(),
+                                "mkdir " + path);
+}
+
+static void append_notes(std::string &output, const sandbox_result &result,
+                         const char *what) {
+    if (result.truncated)
+        output += "\n[output truncated]";
+    else if (result.timed_out)
+        output += std::string("\n[") + what + " timed out]";
+    else if (WIFSIGNALED(result.status))
+        output += std::string("\n[") + what + " killed by signal " +
+                  std::to_string(WTERMSIG(result.status)) + "]";
+}
+
+// Stops early once the bot has written to socket, which it only does to
+// cancel the job.
+static run_cpp_output build_and_run(
+    const std::vector<std::string> &compile_argv,
+    const std::vector<std::string> &compile_paths,
+    const std::string &directory, const local_backend::options &options,
+    const std::string &code, int socket) {
+    {
+        std::ofstream source(directory + "/main.cpp", std::ios::trunc);
+        source << code;
+        if (!source)
+            throw std::runtime_error("can't write main.cpp");
+    }
+
+    ::unlink((directory + "/a.out").c_str());
+
+    const auto compiled = run_sandboxed(compile_argv, directory, compile_paths,
+                                        options.compile_limits, socket);
+
+    run_cpp_output output{compiled.output,
+                          !compiled.timed_out && !compiled.canceled};
+
+    if (compiled.truncated || compiled.timed_out || compiled.canceled ||
+        !WIFEXITED(compiled.status) || WEXITSTATUS(compiled.status) != 0) {
+        append_notes(output.text, compiled, "compiler");
+
+        return output;
+    }
+
+    const auto ran = run_sandboxed({"./a.out"}, directory, options.toolchain,
+                                   options.run_limits, socket);
+
+    output.text += ran.output;
+    output.cacheable = !ran.timed_out && !ran.canceled;
+    append_notes(output.text, ran, "program");
+
+    return output;
+}
+
+// What the bot sends a worker starts with one of these bytes; a job goes on
+// with the code as a frame.
+static const char request_job = 0;
+static const char request_cancel = 1;
+
+// A worker's reply starts with one of these bytes.
+static const char reply_error = 0;
+static const char reply_cacheable = 1;
+static const char reply_output = 2;
+
+// The loop of a worker process. It only ends when the bot closes its end of
+// the socket.
+[[noreturn]] static void serve(int socket,
+                               const std::vector<std::string> &compile_argv,
+                               const std::vector<std::string> &compile_paths,
+                               const std::string &directory,
+                               const local_backend::options &options) {
+    // Ctrl-C reaches the whole process group; the bot shuts the workers down
+    // itself.
+    std::signal(SIGINT, SIG_IGN);
+
+    char request;
+    std::string code;
+    while (receive_all(socket, &request, 1)) {
+        // For a job that has already finished.
+        if (request == request_cancel)
+            continue;
+
+        if (!receive_frame(socket, code))
+            break;
+
+        char status;
+        std::string reply;
+
+        try {
+            auto output = build_and_run(compile_argv, compile_paths, directory,
+                                        options, code, socket);
+            status = output.cacheable ? reply_cacheable : reply_output;
+            reply = std::move(output.text);
+        } catch (const std::exception &error) {
+            status = reply_error;
+            reply = error.what();
+        }
+
+        if (!send_all(socket, &status, 1) || !send_frame(socket, reply))
+            break;
+    }
+
+    ::_exit(0);
+}
+
+// The loop of the fork server. For each directory the bot sends, it forks a
+// worker and replies with its pid and the bot's end of its socket, or -1. It
+// only ends when the bot closes its end of the socket.
+[[noreturn]] static void
+serve_forks(int socket, const std::vector<std::string> &compile_argv,
+            const std::vector<std::string> &compile_paths,
+            const local_backend::options &options) {
+    std::signal(SIGINT, SIG_IGN);
+    // The kernel reaps the workers.
+    std::signal(SIGCHLD, SIG_IGN);
+
+    std::string directory;
+    while (receive_frame(socket, directory)) {
+        int sockets[2];
+        pid_t pid = -1;
+
+        if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) ==
+            0) {
+            pid = ::fork();
+            if (pid == 0) {
+                ::close(socket);
+                ::close(sockets[0]);
+                std::signal(SIGCHLD, SIG_DFL);
+
+                serve(sockets[1], compile_argv, compile_paths, directory,
+                      options);
+            }
+
+            ::close(sockets[1]);
+        } else {
+            sockets[0] = -1;
+        }
+
+        const bool sent =
+            send_descriptor(socket, pid, pid > 0 ? sockets[0] : -1);
+        if (sockets[0] >= 0)
+            ::close(sockets[0]);
+        if (!sent)
+            break;
+    }
+
+    ::_exit(0);
+}
+
+static constexpr std::chrono::milliseconds respawn_min_delay(100);
+static constexpr std::chrono::milliseconds respawn_max_delay(10000);
+
+local_backend::local_backend(const options &options) : options_(options) {
+    make_directory(options_.directory);
+
+    compile_argv_.push_back(options_.compiler);
+    compile_argv_.insert(compile_argv_.end(), options_.flags.begin(),
+                         options_.flags.end());
+
+    command_ = options_.compiler;
+    for (const auto &flag : options_.flags)
+        command_ += ' ' + flag;
+    command_ += " main.cpp -o a.out && ./a.out";
+
+    // Fails early where the jail can't be built.
+    const auto probe =
+        run_sandboxed({options_.compiler, "--version"}, options_.directory,
+                      options_.toolchain, options_.compile_limits);
+    if (probe.timed_out || !WIFEXITED(probe.status) ||
+        WEXITSTATUS(probe.status) != 0)
+        throw std::runtime_error("the compiler doesn't run in the sandbox: " +
+                                 probe.output);
+
+    compile_paths_ = options_.toolchain;
+
+    precompile();
+
+    compile_argv_.insert(compile_argv_.end(), {"main.cpp", "-o", "a.out"});
+
+    int sockets[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) != 0)
+        throw std::system_error(errno, std::generic_category(), "socketpair");
+
+    fork_server_ = ::fork();
+    if (fork_server_ < 0)
+        throw std::system_error(errno, std::generic_category(), "fork");
+
+    if (fork_server_ == 0) {
+        ::close(sockets[0]);
+
+        serve_forks(sockets[1], compile_argv_, compile_paths_, options_);
+    }
+
+    ::close(sockets[1]);
+    fork_socket_ = sockets[0];
+
+    const std::size_t count = std::max<std::size_t>(options_.workers, 1);
+
+    for (std::size_t i = 0; i < count; ++i) {
+        const std::string directory =
+            options_.directory + "/worker-" + std::to_string(i);
+        make_directory(directory);
+
+        workers_.emplace_back(new worker{directory, -1, -1, {}});
+        if (spawn(*workers_.back()) != spawn_result::spawned)
+            throw std::runtime_error("can't fork the workers");
+    }
+
+    live_workers_ = workers_.size();
+
+    for (auto &worker : workers_)
+        worker->thread =
+            std::thread(&local_backend::dispatch, this, std::ref(*worker));
+}
+
+local_backend::~local_backend() {
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        stopping_ = true;
+    }
+
+    condition_.notify_all();
+    stopped_.notify_all();
+
+    // The workers exit once their sockets are closed, and the fork server
+    // once its own is.
+    for (auto &worker : workers_) {
+        worker->thread.join();
+
+        if (worker->socket >= 0)
+            ::close(worker->socket);
+    }
+
+    if (fork_socket_ >= 0)
+        ::close(fork_socket_);
+    ::waitpid(fork_server_, nullptr, 0);
+
+    for (auto &job : jobs_)
+        job.done.set({});
+}
+
+// Builds the header with the flags snippets are compiled with; GCC and Clang
+// only use a precompiled header built with compatible ones. The path has to
+// be absolute because snippets are compiled in the workers' directories, and
+// their jails show it at the same place.
+void local_backend::precompile() {
+    char resolved[PATH_MAX];
+    if (::realpath(options_.directory.c_str(), resolved) == nullptr)
+        return;
+
+    const std::string directory = std::string(resolved) + "/pch";
+    make_directory(directory);
+
+    {
+        std::ofstream header(directory + "/std.h", std::ios::trunc);
+        header << precompiled_header;
+        if (!header)
+            return;
+    }
+
+    const bool clang = options_.compiler.find("clang") != std::string::npos;
+    const std::string output =
+        directory + (clang ? "/std.h.pch" : "/std.h.gch");
+
+    auto argv = compile_argv_;
+    argv.insert(argv.end(), {"-x", "c++-header", "std.h", "-o", output});
+
+    try {
+        const auto result = run_sandboxed(argv, directory, options_.toolchain,
+                                          options_.compile_limits);
+        if (result.timed_out || !WIFEXITED(result.status) ||
+            WEXITSTATUS(result.status) != 0)
+            return;
+    } catch (const std::system_error &) {
+        return;
+    }
+
+    if (clang)
+        compile_argv_.insert(compile_argv_.end(), {"-include-pch", output});
+    else
+        compile_argv_.insert(compile_argv_.end(),
+                             {"-include", directory + "/std.h"});
+
+    compile_paths_.push_back(directory);
+    precompiled_ = true;
+}
+
+pplx::task<std::experimental::optional<run_cpp_output>>
+local_backend::run(const std::string &code, pplx::cancellation_token token) {
+    pplx::task_completion_event<std::experimental::optional<run_cpp_output>>
+        done;
+    const auto progress = std::make_shared<job_progress>();
+
+    // Completing the event twice is harmless; the first value wins.
+    if (token.is_cancelable())
+        token.register_callback([done, progress] {
+            done.set({});
+
+            std::lock_guard<std::mutex> guard(progress->mutex);
+            if (progress->socket >= 0)
+                send_all(progress->socket, &request_cancel, 1);
+        });
+
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+
+        if (live_workers_ == 0) {
+            spdlog::get("logger")->error("❌ local_backend: no workers left");
+
+            return pplx::task_from_result(
+                std::experimental::optional<run_cpp_output>());
+        }
+
+        jobs_.push_back({code, done, token, progress});
+    }
+
+    condition_.notify_one();
+
+    return pplx::create_task(done);
+}
+
+local_backend::spawn_result local_backend::spawn(worker &worker) {
+    std::lock_guard<std::mutex> guard(fork_mutex_);
+
+    if (fork_socket_ < 0)
+        return spawn_result::no_fork_server;
+
+    std::int32_t pid;
+    int socket;
+
+    if (!send_frame(fork_socket_, worker.directory) ||
+        !receive_descriptor(fork_socket_, pid, socket)) {
+        ::close(fork_socket_);
+        fork_socket_ = -1;
+
+        return spawn_result::no_fork_server;
+    }
+
+    if (socket < 0)
+        return spawn_result::failed;
+
+    worker.pid = pid;
+    worker.socket = socket;
+
+    return spawn_result::spawned;
+}
+
+// Waits delay, doubled for the next time, and forks a replacement for a dead
+// worker, until one could be forked. Returns false if the fork server is
+// gone or the backend is stopping.
+bool local_backend::respawn(worker &worker,
+                            std::chrono::milliseconds &delay) {
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (stopped_.wait_for(lock, delay, [this] { return stopping_; }))
+                return false;
+        }
+
+        delay = std::min(delay * 2, respawn_max_delay);
+
+        const pid_t dead = worker.pid;
+
+        switch (spawn(worker)) {
+        case spawn_result::spawned:
+            spdlog::get("logger")->info(
+                "ℹ️ local_backend: worker {} replaced by {}", dead, worker.pid);
+
+            return true;
+        case spawn_result::failed:
+            spdlog::get("logger")->error(
+                "❌ local_backend: can't fork a worker");
+
+            break;
+        case spawn_result::no_fork_server:
+            spdlog::get("logger")->error(
+                "❌ local_backend: the fork server is gone");
+
+            return false;
+        }
+    }
+}
+
+// Hands jobs to one worker process, one at a time. If the worker dies its
+// job fails, and it is replaced while the others carry on.
+void local_backend::dispatch(worker &worker) {
+    auto delay = respawn_min_delay;
+
+    for (;;) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+        if (stopping_)
+            return;
+
+        job job = std::move(jobs_.front());
+        jobs_.pop_front();
+
+        lock.unlock();
+
+        const auto start = std::chrono::steady_clock::now();
+        bool sent;
+
+        // A token canceled before this is seen here, and one canceled after
+        // sees the socket.
+        {
+            std::lock_guard<std::mutex> guard(job.progress->mutex);
+            if (job.token.is_canceled())
+                continue;
+
+            sent = send_all(worker.socket, &request_job, 1) &&
+                   send_frame(worker.socket, job.code);
+            job.progress->socket = worker.socket;
+        }
+
+        char status = reply_error;
+        std::string reply;
+
+        const bool answered = sent &&
+                              receive_all(worker.socket, &status, 1) &&
+                              receive_frame(worker.socket, reply);
+
+        {
+            std::lock_guard<std::mutex> guard(job.progress->mutex);
+            job.progress->socket = -1;
+        }
+
+        if (!answered) {
+            record_upstream(upstream::local_compiler,
+                            std::chrono::steady_clock::now() - start, true);
+
+            spdlog::get("logger")->error("❌ local_backend: worker {} died",
+                                         worker.pid);
+
+            job.done.set({});
+
+            ::close(worker.socket);
+            worker.socket = -1;
+
+            if (respawn(worker, delay))
+                continue;
+
+            std::lock_guard<std::mutex> guard(mutex_);
+            if (--live_workers_ == 0) {
+                for (auto &queued : jobs_)
+                    queued.done.set({});
+                jobs_.clear();
+            }
+
+            return;
+        }
+
+        delay = respawn_min_delay;
+
+        // Canceled jobs are left out, as pooled_request() leaves out
+        // canceled calls.
+        if (!job.token.is_canceled())
+            record_upstream(upstream::local_compiler,
+                            std::chrono::steady_clock::now() - start,
+                            status == reply_error);
+
+        if (status != reply_error) {
+            job.done.set(
+                run_cpp_output{std::move(reply), status == reply_cacheable});
+        } else {
+            spdlog::get("logger")->error("❌ local_backend: {}", reply);
+
+            job.done.set({});
+        }
+    }
+}
+}
@@ -4,160 +4,510 @@
 // license information.
 //
 
+#include "bot.h"
+#include "command.h"
 #include "config.h"
+#include "dispatch.h"
+#include "executor.h"
 #include "funny_pics.h"
 #include "girl_pics.h"
 #include "joke.h"
+#include "local_backend.h"
 #include "message.h"
+#include "metrics.h"
 #include "quote.h"
 #include "run_cpp.h"
-#include <boost/lockfree/spsc_queue.hpp>
+#include "shard.h"
+#include "trace.h"
+#include "upstream_guard.h"
+#include "webhook.h"
 #include <boost/program_options.hpp>
 #include <csignal>
+#include <fstream>
 #include <nlohmann/json.hpp>
 #include <spdlog/spdlog.h>
+#include <thread>
 
-enum class bot_command : std::uint8_t {
-    quote,
-    joke,
-    funny_pics,
-    girl_pics,
-    run_cpp,
-    about
-};
+using ohmyarch::bot_command;
+using ohmyarch::chat_command;
+using ohmyarch::queued_command;
+
+static std::atomic<bool> keep_running(true);
 
-class message {
-  public:
-    message(bot_command command) : command_(command) {}
-    message(bot_command command, std::int32_t id, std::string &&code) noexcept
-        : command_(command), id_(id), code_(std::move(code)) {}
+static void signal_handler(int signal) { keep_running = false; }
 
-    bot_command command() const { return command_; }
-    std::int32_t id() const { return id_; }
-    const std::string &code() const { return code_; }
+static void trace_signal_handler(int signal) {
+    ohmyarch::request_trace_export();
+}
 
-  private:
-    bot_command command_;
-    std::int32_t id_;
-    std::string code_;
+// A bot with its command table and the /run_cpp messages it is answering. In
+// the ingress of shard workers, run_cpp_jobs only numbers the versions of a
+// message; the workers track the runs.
+struct hosted_bot {
+    std::unique_ptr<ohmyarch::bot> bot;
+    std::string username;
+    std::unique_ptr<ohmyarch::command_registry> commands;
+    ohmyarch::run_cpp_jobs run_cpp_jobs{4096};
+    ohmyarch::stale_backlog stale_backlog;
+    std::unique_ptr<ohmyarch::webhook> webhook;
+    // Set once polling has stopped, if the bot polls.
+    bool polling = false;
+    pplx::task_completion_event<void> stopped;
 };
 
-using namespace std::chrono_literals;
-using message_queue =
-    boost::lockfree::spsc_queue<message, boost::lockfree::capacity<100>>;
+// The Threads: line of /proc/self/status.
+static double process_threads() {
+    std::ifstream status("/proc/self/status");
 
-static std::atomic<bool> keep_running(true);
+    std::string line;
+    while (std::getline(status, line))
+        if (line.compare(0, 8, "Threads:") == 0)
+            return std::stod(line.substr(8));
 
-static std::unordered_map<std::int64_t, std::shared_ptr<message_queue>>
-    message_queue_map;
+    return 0;
+}
 
-static std::mutex map_mutex;
+static void register_metrics(const ohmyarch::executor &executor) {
+    using ohmyarch::metric_type;
+    using ohmyarch::register_metric;
+
+    register_metric("ohmyarch_queued_commands",
+                    "Commands waiting in the per-chat queues.",
+                    metric_type::gauge,
+                    [&executor] { return executor.queued(); });
+    register_metric("ohmyarch_active_chats",
+                    "Chats with a command queued or running.",
+                    metric_type::gauge,
+                    [&executor] { return executor.active_keys(); });
+    register_metric("ohmyarch_worker_threads",
+                    "Threads running bot commands.", metric_type::gauge,
+                    [&executor] { return executor.size(); });
+    register_metric("ohmyarch_process_threads",
+                    "Threads of the process, including HTTP and logging.",
+                    metric_type::gauge, process_threads);
+    register_metric("ohmyarch_pending_sends",
+                    "Messages waiting for Telegram's flood limits.",
+                    metric_type::gauge, ohmyarch::pending_sends);
+
+    const auto &statistics = executor.statistics();
+    register_metric("ohmyarch_commands_enqueued_total",
+                    "Commands accepted into a queue.", metric_type::counter,
+                    [&statistics] { return statistics.enqueued.load(); });
+    register_metric("ohmyarch_commands_dropped_total",
+                    "Commands dropped by a full queue.", metric_type::counter,
+                    [&statistics] { return statistics.dropped.load(); });
+    register_metric("ohmyarch_commands_collapsed_total",
+                    "Commands collapsed into an equal queued one.",
+                    metric_type::counter,
+                    [&statistics] { return statistics.collapsed.load(); });
+
+    register_metric("ohmyarch_upstream_hedged_total",
+                    "Second copies of slow upstream GETs.",
+                    metric_type::counter, ohmyarch::hedged_requests);
+    register_metric("ohmyarch_upstream_rejected_total",
+                    "Upstream calls refused by an open circuit.",
+                    metric_type::counter, ohmyarch::rejected_requests);
+}
 
-static void signal_handler(int signal) { keep_running = false; }
+// The span of what a command fetched before replying.
+static void record_fetch(std::uint64_t trace, const char *name,
+                         ohmyarch::trace_clock::time_point started,
+                         std::int64_t chat_id) {
+    ohmyarch::record_span(trace, name, started,
+                          ohmyarch::trace_clock::now(), chat_id);
+}
+
+// Called in the trace of the command; the continuations open it again for
+// the sends.
+static pplx::task<void> handle(hosted_bot &hosted, std::int64_t chat_id,
+                               const queued_command &message) {
+    const ohmyarch::bot &bot = *hosted.bot;
+    auto &run_cpp_jobs = hosted.run_cpp_jobs;
+    const std::uint64_t trace = ohmyarch::current_trace();
+    const auto started = ohmyarch::trace_clock::now();
+
+    switch (message.command()) {
+    case bot_command::quote:
+        return ohmyarch::get_quote().then(
+            [&bot, chat_id, trace,
+             started](std::experimental::optional<ohmyarch::quote> quote) {
+                record_fetch(trace, "get_quote", started, chat_id);
+                const ohmyarch::trace_scope scope(trace);
+
+                if (!quote)
+                    return pplx::task_from_result();
+
+                return ohmyarch::send_message(
+                    bot, chat_id,
+                    "_" + quote->text() + " - " + quote->author() + "_", {},
+                    ohmyarch::formatting_options::markdown_style);
+            });
+    case bot_command::joke:
+        return ohmyarch::get_joke().then(
+            [&bot, chat_id, trace,
+             started](std::experimental::optional<std::string> joke) {
+                record_fetch(trace, "get_joke", started, chat_id);
+                const ohmyarch::trace_scope scope(trace);
+
+                if (!joke)
+                    return pplx::task_from_result();
+
+                return ohmyarch::send_message(bot, chat_id, joke.value());
+            });
+    case bot_command::funny_pics:
+        return ohmyarch::get_funny_pics().then(
+            [&bot, chat_id, trace, started](
+                std::experimental::optional<std::vector<std::string>> pics) {
+                record_fetch(trace, "get_funny_pics", started, chat_id);
+                const ohmyarch::trace_scope scope(trace);
+
+                if (!pics)
+                    return pplx::task_from_result();
+
+                return ohmyarch::send_pictures(bot, chat_id, pics.value());
+            });
+    case bot_command::girl_pics:
+        return ohmyarch::get_girl_pics().then(
+            [&bot, chat_id, trace, started](
+                std::experimental::optional<std::vector<std::string>> pics) {
+                record_fetch(trace, "get_girl_pics", started, chat_id);
+                const ohmyarch::trace_scope scope(trace);
+
+                if (!pics)
+                    return pplx::task_from_result();
+
+                return ohmyarch::send_pictures(bot, chat_id, pics.value());
+            });
+    case bot_command::run_cpp: {
+        const auto &ticket = message.ticket();
+
+        // The message has been edited since this version was queued.
+        if (!run_cpp_jobs.current(ticket))
+            return pplx::task_from_result();
+
+        return ohmyarch::run_cpp(message.code(), ticket.token)
+            .then([&bot, &run_cpp_jobs, chat_id, ticket, trace,
+                   started](std::experimental::optional<std::string> output) {
+                record_fetch(trace, "run_cpp", started, chat_id);
+                const ohmyarch::trace_scope scope(trace);
+
+                if (!output || !run_cpp_jobs.current(ticket))
+                    return pplx::task_from_result();
+
+                const std::string text =
+                    ohmyarch::format_run_cpp_output(std::move(output.value()));
+
+                const auto reply_id = run_cpp_jobs.reply(ticket);
+                if (reply_id)
+                    return ohmyarch::edit_message_text(
+                        bot, chat_id, reply_id.value(), text,
+                        ohmyarch::formatting_options::markdown_style);
+
+                return ohmyarch::reply_message(
+                           bot, chat_id, text, ticket.message_id,
+                           ohmyarch::formatting_options::markdown_style)
+                    .then([&run_cpp_jobs, ticket](
+                              std::experimental::optional<std::int32_t> id) {
+                        if (id)
+                            run_cpp_jobs.set_reply(ticket, id.value());
+                    });
+            });
+    }
+    case bot_command::about:
+        return ohmyarch::send_message(
+            bot, chat_id, "https://github.com/ohmyarch/ohmyarch_bot");
+    }
+
+    return pplx::task_from_result();
+}
+
+// receipt is released once the command has run or has been dropped.
+static void post(ohmyarch::executor &executor, hosted_bot &hosted,
+                 std::int64_t chat_id, const queued_command &message,
+                 std::uint64_t trace, std::shared_ptr<void> receipt = nullptr) {
+    const auto received = ohmyarch::trace_clock::now();
+
+    const auto task = [&hosted, chat_id, message, trace, received, receipt] {
+        const bot_command command = message.command();
+        const auto started = ohmyarch::trace_clock::now();
+        ohmyarch::record_span(trace, "queued", received, started, chat_id);
+
+        const ohmyarch::trace_scope scope(trace);
+
+        return handle(hosted, chat_id, message)
+            .then([command, chat_id, trace, received, started,
+                   receipt](pplx::task<void> task) {
+                const auto now = ohmyarch::trace_clock::now();
+                ohmyarch::record_command(command, now - received);
+                ohmyarch::record_span(trace, "handle", started, now, chat_id);
+
+                task.get();
+            });
+    };
+
+    // Chat ids take up less than 53 bits, so the bot's index in the top byte
+    // keeps the chats of different bots apart.
+    const std::int64_t key =
+        chat_id ^ static_cast<std::int64_t>(hosted.bot->index() << 56);
+
+    if (!executor.post(key, task, message.signature()))
+        spdlog::get("logger")->warn("⚠️ command dropped for 💬<{}> of @{}",
+                                    chat_id, hosted.username);
+}
+
+// Hands a command to the worker process its chat belongs to.
+static void route(ohmyarch::shard_router &router, const hosted_bot &hosted,
+                  chat_command &command) {
+    const queued_command &message = command.command;
+
+    ohmyarch::shard_command shard{};
+    shard.bot = static_cast<std::uint8_t>(hosted.bot->index());
+    shard.command = message.command();
+    shard.chat_id = command.chat_id;
+    shard.trace_id = command.trace_id;
+    if (message.command() == bot_command::run_cpp) {
+        shard.message_id = message.ticket().message_id;
+        shard.code = message.code();
+    }
+
+    router.route(std::move(shard));
+}
+
+// Where the commands found in updates go: the executor of this process, or
+// the shard workers if it is their ingress.
+using command_sink = std::function<void(hosted_bot &, chat_command &)>;
+
+// Hands on the commands in updates. Called from the polling continuations,
+// with polled set, or from the webhook listeners' threads.
+static void dispatch(const command_sink &sink, hosted_bot &hosted,
+                     const ohmyarch::update_batch &updates,
+                     bool polled = false) {
+    const auto received = ohmyarch::trace_clock::now();
+
+    const std::int64_t stale_before =
+        std::chrono::duration_cast<std::chrono::seconds>(
+            (std::chrono::system_clock::now() - ohmyarch::stale_update_age)
+                .time_since_epoch())
+            .count();
+
+    for (auto &command :
+         ohmyarch::collect_commands(*hosted.commands, hosted.run_cpp_jobs,
+                                    updates, ohmyarch::stale_policy,
+                                    stale_before, &hosted.stale_backlog)) {
+        command.trace_id = ohmyarch::start_trace();
+
+        // The time the long poll waited for an update isn't latency, so
+        // only the point the response arrived is recorded.
+        if (polled)
+            ohmyarch::record_span(command.trace_id, "get_updates", received,
+                                  received, command.chat_id);
+
+        sink(hosted, command);
+
+        ohmyarch::record_span(command.trace_id, "dispatch", received,
+                              ohmyarch::trace_clock::now(), command.chat_id);
+    }
+}
 
-static void consumer(std::int64_t chat_id,
-                     std::shared_ptr<message_queue> queue) {
-    spdlog::get("logger")->info("ℹ️ thread is created for 💬<{}>",
-                                chat_id);
-
-    std::chrono::time_point<std::chrono::steady_clock> start;
-
-    for (;;) {
-        if (!queue->consume_all([&chat_id, &start](message message) {
-                switch (message.command()) {
-                case bot_command::quote: {
-                    const auto quote = ohmyarch::get_quote();
-                    if (quote)
-                        ohmyarch::send_message(
-                            chat_id,
-                            "_" + quote->text() + " - " + quote->author() + "_",
-                            {}, ohmyarch::formatting_options::markdown_style);
-
-                    break;
-                }
-                case bot_command::joke: {
-                    const auto joke = ohmyarch::get_joke();
-                    if (joke)
-                        ohmyarch::send_message(chat_id, joke.value());
-
-                    break;
-                }
-                case bot_command::funny_pics: {
-                    const auto funny_pics = ohmyarch::get_funny_pics();
-                    if (funny_pics) {
-                        for (const auto &pic_uri : funny_pics.value())
-                            if (boost::ends_with(pic_uri, "gif"))
-                                ohmyarch::send_document(chat_id, pic_uri);
-                            else
-                                ohmyarch::send_message(chat_id, pic_uri);
-                    }
-
-                    break;
-                }
-                case bot_command::girl_pics: {
-                    const auto girl_pics = ohmyarch::get_girl_pics();
-                    if (girl_pics) {
-                        for (const auto &pic_uri : girl_pics.value())
-                            if (boost::ends_with(pic_uri, "gif"))
-                                ohmyarch::send_document(chat_id, pic_uri);
-                            else
-                                ohmyarch::send_message(chat_id, pic_uri);
-                    }
-
-                    break;
-                }
-                case bot_command::run_cpp: {
-                    auto output = ohmyarch::run_cpp(message.code());
-                    if (output) {
-                        std::string &output_str = output.value();
-                        boost::replace_all(output.value(), "\n", "`\n`");
-
-                        ohmyarch::send_message(
-                            chat_id, '`' + output_str + '`', message.id(),
-                            ohmyarch::formatting_options::markdown_style);
-                    }
-
-                    break;
-                }
-                case bot_command::about: {
-                    ohmyarch::send_message(
-                        chat_id, "https://github.com/ohmyarch/ohmyarch_bot");
-
-                    break;
-                }
-                }
-
-                start = std::chrono::steady_clock::now();
-            })) {
-            if (std::chrono::duration<double>(std::chrono::steady_clock::now() -
-                                              start)
-                    .count() > 10.0) {
+// Long-polls the bot until SIGINT without a thread of its own: each
+// getUpdates call is made from the continuation of the one before.
+static void poll(const command_sink &sink, hosted_bot &hosted) {
+    ohmyarch::get_updates(
+        *hosted.bot,
+        [&sink, &hosted](const ohmyarch::update_batch &updates) {
+            dispatch(sink, hosted, updates, true);
+        })
+        .then([&sink, &hosted] {
+            if (keep_running)
+                poll(sink, hosted);
+            else
+                hosted.stopped.set();
+        });
+}
+
+// The loop of a shard worker: runs the commands the ingress sends until it
+// closes the socket.
+static void serve_shard(const std::shared_ptr<ohmyarch::shard_inbox> &inbox,
+                        ohmyarch::executor &executor,
+                        std::vector<std::unique_ptr<hosted_bot>> &bots) {
+    ohmyarch::shard_command command;
+
+    while (inbox->receive(command)) {
+        const std::uint64_t sequence = command.sequence;
+
+        // The ingress forgets the command once the last copy is gone, when it
+        // has run or has been dropped.
+        std::shared_ptr<void> receipt(
+            nullptr, [inbox, sequence](void *) { inbox->finish(sequence); });
+
+        if (command.bot >= bots.size())
+            continue;
+        hosted_bot &hosted = *bots[command.bot];
+
+        if (command.command == bot_command::run_cpp)
+            post(executor, hosted, command.chat_id,
+                 {hosted.run_cpp_jobs.start(command.chat_id,
+                                            command.message_id),
+                  std::move(command.code)},
+                 command.trace_id, std::move(receipt));
+        else
+            post(executor, hosted, command.chat_id, command.command,
+                 command.trace_id, std::move(receipt));
+    }
+}
+
+// Polls the bots or starts their webhooks, and hands their commands to sink
+// until SIGINT. Returns main's exit status.
+static int serve_updates(std::vector<std::unique_ptr<hosted_bot>> &bots,
+                         const command_sink &sink) {
+    bool failed = false;
+
+    for (auto &hosted : bots) {
+        const auto &settings = hosted->bot->settings();
+
+        if (settings.webhook.listen_uri.empty()) {
+            // getUpdates is refused while a webhook is set.
+            ohmyarch::delete_webhook(*hosted->bot);
+
+            hosted->polling = true;
+            poll(sink, *hosted);
+        } else {
+            hosted_bot &bot = *hosted;
+
+            try {
+                hosted->webhook.reset(new ohmyarch::webhook(
+                    settings.webhook,
+                    [&sink, &bot](const ohmyarch::update_batch &updates) {
+                        dispatch(sink, bot, updates);
+                    }));
+            } catch (const std::exception &error) {
+                spdlog::get("logger")->error("❌ webhook: {}", error.what());
+
+                failed = true;
+                break;
+            }
+
+            if (!settings.webhook_url.empty() &&
+                !ohmyarch::set_webhook(*hosted->bot, settings.webhook_url,
+                                       settings.webhook.secret_token,
+                                       ohmyarch::webhook_max_connections)) {
+                failed = true;
                 break;
-            } else {
-                std::this_thread::yield();
-                std::this_thread::sleep_for(100ms);
             }
+
+            spdlog::get("logger")->info("ℹ️ webhook of @{} listening on {}",
+                                        hosted->username,
+                                        settings.webhook.listen_uri);
         }
+
+        spdlog::get("logger")->info("🤖️ @{} is running 😉",
+                                    hosted->username);
     }
+    spdlog::get("logger")->flush();
+
+    if (failed)
+        keep_running = false;
 
-    {
-        std::lock_guard<std::mutex> guard(map_mutex);
-        message_queue_map.erase(chat_id);
+    // Updates arrive on the pplx and listener threads; this one only waits
+    // for SIGINT.
+    while (keep_running)
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    // The polls end with their current getUpdates call. The webhooks stop
+    // before what sink hands commands to goes away.
+    for (auto &hosted : bots) {
+        hosted->webhook.reset();
+        if (hosted->polling)
+            pplx::create_task(hosted->stopped).wait();
     }
 
-    spdlog::get("logger")->info("ℹ️ thread is destroyed for 💬<{}>",
-                                chat_id);
+    if (failed)
+        return 1;
+
+    for (const auto &hosted : bots)
+        spdlog::get("logger")->info("🤖️ @{} stopped 😴", hosted->username);
+
+    return 0;
+}
+
+static void log_statistics(const ohmyarch::executor &executor) {
+    const auto &statistics = executor.statistics();
+    spdlog::get("logger")->info(
+        "ℹ️ commands: {} enqueued, {} dropped, {} collapsed, queue "
+        "high-water {}",
+        statistics.enqueued.load(), statistics.dropped.load(),
+        statistics.collapsed.load(), statistics.high_water.load());
+}
+
+// One of the upstreams whose calls are guarded, by name.
+static ohmyarch::upstream guarded_upstream(const std::string &name) {
+    for (const auto upstream :
+         {ohmyarch::upstream::jandan, ohmyarch::upstream::forismatic,
+          ohmyarch::upstream::coliru})
+        if (name == ohmyarch::upstream_name(upstream))
+            return upstream;
+
+    throw std::invalid_argument("unknown upstream " + name);
+}
+
+// The keys of one bot, from an entry of "bots" or from the top level of the
+// config. The webhook's certificate and private key default to shared's.
+static ohmyarch::bot::options
+read_bot_options(const nlohmann::json &json,
+                 const ohmyarch::webhook::options &shared) {
+    ohmyarch::bot::options options;
+    options.token = json.at("token").get<std::string>();
+    options.webhook.certificate = shared.certificate;
+    options.webhook.private_key = shared.private_key;
+
+    const auto iterator_update_offset_path = json.find("update_offset_path");
+    if (iterator_update_offset_path != json.end())
+        options.update_offset_path =
+            iterator_update_offset_path.value().get<std::string>();
+
+    const auto iterator_webhook_listen = json.find("webhook_listen");
+    if (iterator_webhook_listen != json.end())
+        options.webhook.listen_uri =
+            iterator_webhook_listen.value().get<std::string>();
+
+    const auto iterator_webhook_url = json.find("webhook_url");
+    if (iterator_webhook_url != json.end())
+        options.webhook_url = iterator_webhook_url.value().get<std::string>();
+
+    const auto iterator_webhook_secret_token =
+        json.find("webhook_secret_token");
+    if (iterator_webhook_secret_token != json.end())
+        options.webhook.secret_token =
+            iterator_webhook_secret_token.value().get<std::string>();
+
+    const auto iterator_webhook_certificate = json.find("webhook_certificate");
+    if (iterator_webhook_certificate != json.end())
+        options.webhook.certificate =
+            iterator_webhook_certificate.value().get<std::string>();
+
+    const auto iterator_webhook_private_key = json.find("webhook_private_key");
+    if (iterator_webhook_private_key != json.end())
+        options.webhook.private_key =
+            iterator_webhook_private_key.value().get<std::string>();
+
+    return options;
 }
 
 int main(int argc, char *argv[]) {
     std::string path_to_config;
+    std::size_t shard_index = 0;
+    int shard_socket = -1;
 
     boost::program_options::options_description options("options");
     options.add_options()(
         "config", boost::program_options::value<std::string>(&path_to_config)
                       ->value_name("/path/to/config"),
-        "specify a path to a custom config file")("help,h",
-                                                  "print this text and exit");
+        "specify a path to a custom config file")(
+        "shard", boost::program_options::value<std::size_t>(&shard_index),
+        "run as this shard worker; set by the ingress")(
+        "shard-socket", boost::program_options::value<int>(&shard_socket),
+        "the shard worker's socket to the ingress; set by the ingress")(
+        "help,h", "print this text and exit");
 
     boost::program_options::variables_map map;
 
@@ -197,9 +547,25 @@ int main(int argc, char *argv[]) {
     try {
         json << config_file;
 
-        ohmyarch::api_uri =
-            "https://api.telegram.org/bot" +
-            json.at("token").get_ref<const nlohmann::json::string_t &>() + '/';
+        const auto iterator_telegram_uri = json.find("telegram_uri");
+        if (iterator_telegram_uri != json.end())
+            ohmyarch::telegram_uri =
+                iterator_telegram_uri.value().get<std::string>();
+
+        const auto iterator_jandan_uri = json.find("jandan_uri");
+        if (iterator_jandan_uri != json.end())
+            ohmyarch::jandan_uri =
+                iterator_jandan_uri.value().get<std::string>();
+
+        const auto iterator_forismatic_uri = json.find("forismatic_uri");
+        if (iterator_forismatic_uri != json.end())
+            ohmyarch::forismatic_uri =
+                iterator_forismatic_uri.value().get<std::string>();
+
+        const auto iterator_coliru_uri = json.find("coliru_uri");
+        if (iterator_coliru_uri != json.end())
+            ohmyarch::coliru_uri =
+                iterator_coliru_uri.value().get<std::string>();
     } catch (const std::exception &error) {
         std::cerr << "❌ json: " << error.what() << std::endl;
 
@@ -218,14 +584,508 @@ int main(int argc, char *argv[]) {
             return 1;
         }
 
+    try {
+        const auto iterator_polling_timeout = json.find("polling_timeout");
+        if (iterator_polling_timeout != json.end())
+            ohmyarch::polling_timeout = iterator_polling_timeout.value();
+
+        const auto iterator_polling_limit = json.find("polling_limit");
+        if (iterator_polling_limit != json.end())
+            ohmyarch::polling_limit = iterator_polling_limit.value();
+
+        const auto iterator_update_offset_sync_interval =
+            json.find("update_offset_sync_interval");
+        if (iterator_update_offset_sync_interval != json.end())
+            ohmyarch::update_offset_sync_interval =
+                std::chrono::milliseconds(
+                    iterator_update_offset_sync_interval.value()
+                        .get<std::int64_t>());
+
+        const auto iterator_stale_update_age = json.find("stale_update_age");
+        if (iterator_stale_update_age != json.end())
+            ohmyarch::stale_update_age = std::chrono::seconds(
+                iterator_stale_update_age.value().get<std::int64_t>());
+
+        const auto iterator_stale_update_policy =
+            json.find("stale_update_policy");
+        if (iterator_stale_update_policy != json.end()) {
+            const auto &policy =
+                iterator_stale_update_policy.value()
+                    .get_ref<const nlohmann::json::string_t &>();
+            if (policy == "process")
+                ohmyarch::stale_policy = ohmyarch::stale_update_policy::process;
+            else if (policy == "skip")
+                ohmyarch::stale_policy = ohmyarch::stale_update_policy::skip;
+            else if (policy == "collapse")
+                ohmyarch::stale_policy =
+                    ohmyarch::stale_update_policy::collapse;
+            else
+                throw std::invalid_argument("unknown stale_update_policy " +
+                                            policy);
+        }
+
+        const auto iterator_max_connections =
+            json.find("max_connections_per_host");
+        if (iterator_max_connections != json.end())
+            ohmyarch::max_connections_per_host =
+                iterator_max_connections.value();
+
+        const auto iterator_idle_timeout =
+            json.find("connection_idle_timeout");
+        if (iterator_idle_timeout != json.end())
+            ohmyarch::connection_idle_timeout = std::chrono::seconds(
+                iterator_idle_timeout.value().get<std::int64_t>());
+
+        const auto iterator_worker_threads = json.find("worker_threads");
+        if (iterator_worker_threads != json.end())
+            ohmyarch::worker_threads = iterator_worker_threads.value();
+
+        const auto iterator_queue_capacity = json.find("queue_capacity");
+        if (iterator_queue_capacity != json.end())
+            ohmyarch::queue_capacity = iterator_queue_capacity.value();
+
+        const auto iterator_overload_policy = json.find("overload_policy");
+        if (iterator_overload_policy != json.end()) {
+            const auto &policy =
+                iterator_overload_policy.value()
+                    .get_ref<const nlohmann::json::string_t &>();
+            if (policy == "drop_oldest")
+                ohmyarch::queue_overload_policy =
+                    ohmyarch::overload_policy::drop_oldest;
+            else if (policy == "drop_newest")
+                ohmyarch::queue_overload_policy =
+                    ohmyarch::overload_policy::drop_newest;
+            else if (policy == "collapse_duplicates")
+                ohmyarch::queue_overload_policy =
+                    ohmyarch::overload_policy::collapse_duplicates;
+            else
+                throw std::invalid_argument("unknown overload_policy " +
+                                            policy);
+        }
+
+        const auto iterator_prefetch_capacity =
+            json.find("prefetch_capacity");
+        if (iterator_prefetch_capacity != json.end())
+            ohmyarch::prefetch_capacity = iterator_prefetch_capacity.value();
+
+        const auto iterator_prefetch_low_watermark =
+            json.find("prefetch_low_watermark");
+        if (iterator_prefetch_low_watermark != json.end())
+            ohmyarch::prefetch_low_watermark =
+                iterator_prefetch_low_watermark.value();
+
+        const auto iterator_prefetch_ttl = json.find("prefetch_ttl");
+        if (iterator_prefetch_ttl != json.end())
+            ohmyarch::prefetch_ttl = std::chrono::seconds(
+                iterator_prefetch_ttl.value().get<std::int64_t>());
+
+        const auto iterator_run_cpp_cache_capacity =
+            json.find("run_cpp_cache_capacity");
+        if (iterator_run_cpp_cache_capacity != json.end())
+            ohmyarch::run_cpp_cache_capacity =
+                iterator_run_cpp_cache_capacity.value();
+
+        const auto iterator_run_cpp_cache_ttl = json.find("run_cpp_cache_ttl");
+        if (iterator_run_cpp_cache_ttl != json.end())
+            ohmyarch::run_cpp_cache_ttl = std::chrono::seconds(
+                iterator_run_cpp_cache_ttl.value().get<std::int64_t>());
+
+        const auto iterator_run_cpp_cache_path =
+            json.find("run_cpp_cache_path");
+        if (iterator_run_cpp_cache_path != json.end())
+            ohmyarch::run_cpp_cache_path =
+                iterator_run_cpp_cache_path.value().get<std::string>();
+
+        const auto iterator_run_cpp_backend = json.find("run_cpp_backend");
+        if (iterator_run_cpp_backend != json.end()) {
+            ohmyarch::run_cpp_backend_name =
+                iterator_run_cpp_backend.value().get<std::string>();
+            if (ohmyarch::run_cpp_backend_name != "coliru" &&
+                ohmyarch::run_cpp_backend_name != "local")
+                throw std::invalid_argument("unknown run_cpp_backend " +
+                                            ohmyarch::run_cpp_backend_name);
+        }
+
+        auto &local = ohmyarch::local_backend_options;
+
+        const auto iterator_local_compiler = json.find("local_compiler");
+        if (iterator_local_compiler != json.end())
+            local.compiler = iterator_local_compiler.value().get<std::string>();
+
+        const auto iterator_local_compiler_flags =
+            json.find("local_compiler_flags");
+        if (iterator_local_compiler_flags != json.end())
+            local.flags = iterator_local_compiler_flags.value()
+                              .get<std::vector<std::string>>();
+
+        const auto iterator_local_directory = json.find("local_directory");
+        if (iterator_local_directory != json.end())
+            local.directory =
+                iterator_local_directory.value().get<std::string>();
+
+        const auto iterator_local_workers = json.find("local_workers");
+        if (iterator_local_workers != json.end())
+            local.workers = iterator_local_workers.value();
+
+        const auto iterator_local_compile_timeout =
+            json.find("local_compile_timeout");
+        if (iterator_local_compile_timeout != json.end()) {
+            const std::int64_t seconds =
+                iterator_local_compile_timeout.value();
+            local.compile_limits.wall_time = std::chrono::seconds(seconds);
+            local.compile_limits.cpu_seconds = seconds;
+        }
+
+        const auto iterator_local_run_timeout = json.find("local_run_timeout");
+        if (iterator_local_run_timeout != json.end()) {
+            const std::int64_t seconds = iterator_local_run_timeout.value();
+            local.run_limits.wall_time = std::chrono::seconds(seconds);
+            local.run_limits.cpu_seconds = seconds;
+        }
+
+        // In MiB.
+        const auto iterator_local_memory_limit =
+            json.find("local_memory_limit");
+        if (iterator_local_memory_limit != json.end())
+            local.run_limits.memory_bytes =
+                iterator_local_memory_limit.value().get<std::uint64_t>()
+                << 20;
+
+        const auto iterator_local_output_limit =
+            json.find("local_output_limit");
+        if (iterator_local_output_limit != json.end()) {
+            local.compile_limits.output_bytes =
+                iterator_local_output_limit.value();
+            local.run_limits.output_bytes = local.compile_limits.output_bytes;
+        }
+
+        const auto iterator_local_toolchain_paths =
+            json.find("local_toolchain_paths");
+        if (iterator_local_toolchain_paths != json.end())
+            local.toolchain = iterator_local_toolchain_paths.value()
+                                  .get<std::vector<std::string>>();
+
+        // The certificate and private key at the top level are shared by the
+        // bots. Without "bots", the top level configures the only bot.
+        ohmyarch::webhook::options shared_webhook;
+
+        const auto iterator_webhook_certificate =
+            json.find("webhook_certificate");
+        if (iterator_webhook_certificate != json.end())
+            shared_webhook.certificate =
+                iterator_webhook_certificate.value().get<std::string>();
+
+        const auto iterator_webhook_private_key =
+            json.find("webhook_private_key");
+        if (iterator_webhook_private_key != json.end())
+            shared_webhook.private_key =
+                iterator_webhook_private_key.value().get<std::string>();
+
+        const auto iterator_bots = json.find("bots");
+        if (iterator_bots != json.end())
+            for (const auto &bot : iterator_bots.value())
+                ohmyarch::bots.push_back(read_bot_options(bot, shared_webhook));
+        if (ohmyarch::bots.empty())
+            ohmyarch::bots.push_back(read_bot_options(json, shared_webhook));
+
+        const auto iterator_webhook_max_connections =
+            json.find("webhook_max_connections");
+        if (iterator_webhook_max_connections != json.end())
+            ohmyarch::webhook_max_connections =
+                iterator_webhook_max_connections.value();
+
+        const auto iterator_metrics_listen = json.find("metrics_listen");
+        if (iterator_metrics_listen != json.end())
+            ohmyarch::metrics_listen =
+                iterator_metrics_listen.value().get<std::string>();
+
+        const auto iterator_shard_workers = json.find("shard_workers");
+        if (iterator_shard_workers != json.end())
+            ohmyarch::shard_workers = iterator_shard_workers.value();
+
+        // In milliseconds, per upstream.
+        const auto iterator_upstream_deadlines =
+            json.find("upstream_deadlines");
+        if (iterator_upstream_deadlines != json.end()) {
+            const auto &deadlines = iterator_upstream_deadlines.value();
+            for (auto iterator = deadlines.begin(); iterator != deadlines.end();
+                 ++iterator) {
+                const auto index = static_cast<std::size_t>(
+                    guarded_upstream(iterator.key()));
+                ohmyarch::upstream_policies[index].deadline =
+                    std::chrono::milliseconds(
+                        iterator.value().get<std::int64_t>());
+            }
+        }
+
+        const auto iterator_hedged_upstreams = json.find("hedged_upstreams");
+        if (iterator_hedged_upstreams != json.end())
+            for (const auto &name : iterator_hedged_upstreams.value()) {
+                const auto index =
+                    static_cast<std::size_t>(guarded_upstream(name));
+                ohmyarch::upstream_policies[index].hedge = true;
+            }
+
+        const auto iterator_hedge_min_delay = json.find("hedge_min_delay");
+        if (iterator_hedge_min_delay != json.end())
+            ohmyarch::hedge_min_delay = std::chrono::milliseconds(
+                iterator_hedge_min_delay.value().get<std::int64_t>());
+
+        const auto iterator_circuit_breaker_window =
+            json.find("circuit_breaker_window");
+        if (iterator_circuit_breaker_window != json.end())
+            ohmyarch::breaker_limits.window =
+                iterator_circuit_breaker_window.value();
+
+        const auto iterator_circuit_breaker_failure_rate =
+            json.find("circuit_breaker_failure_rate");
+        if (iterator_circuit_breaker_failure_rate != json.end())
+            ohmyarch::breaker_limits.failure_rate =
+                iterator_circuit_breaker_failure_rate.value();
+
+        const auto iterator_circuit_breaker_cooldown =
+            json.find("circuit_breaker_cooldown");
+        if (iterator_circuit_breaker_cooldown != json.end())
+            ohmyarch::breaker_limits.cooldown = std::chrono::seconds(
+                iterator_circuit_breaker_cooldown.value().get<std::int64_t>());
+
+        const auto iterator_trace_sample_rate =
+            json.find("trace_sample_rate");
+        if (iterator_trace_sample_rate != json.end())
+            ohmyarch::trace_sample_rate = iterator_trace_sample_rate.value();
+
+        const auto iterator_trace_buffer_spans =
+            json.find("trace_buffer_spans");
+        if (iterator_trace_buffer_spans != json.end())
+            ohmyarch::trace_buffer_spans = iterator_trace_buffer_spans.value();
+
+        const auto iterator_trace_path = json.find("trace_path");
+        if (iterator_trace_path != json.end())
+            ohmyarch::trace_path =
+                iterator_trace_path.value().get<std::string>();
+
+        const auto iterator_trace_format = json.find("trace_format");
+        if (iterator_trace_format != json.end()) {
+            const std::string format =
+                iterator_trace_format.value().get<std::string>();
+            if (format == "chrome")
+                ohmyarch::trace_file_format = ohmyarch::trace_format::chrome;
+            else if (format == "otlp")
+                ohmyarch::trace_file_format = ohmyarch::trace_format::otlp;
+            else
+                throw std::invalid_argument("unknown trace_format " + format);
+        }
+
+        const auto iterator_send_rate_global = json.find("send_rate_global");
+        if (iterator_send_rate_global != json.end())
+            ohmyarch::send_limits.global_per_second =
+                iterator_send_rate_global.value();
+
+        const auto iterator_send_rate_private =
+            json.find("send_rate_private");
+        if (iterator_send_rate_private != json.end())
+            ohmyarch::send_limits.private_per_second =
+                iterator_send_rate_private.value();
+
+        // Per minute, as Telegram documents it.
+        const auto iterator_send_rate_group = json.find("send_rate_group");
+        if (iterator_send_rate_group != json.end())
+            ohmyarch::send_limits.group_per_second =
+                iterator_send_rate_group.value().get<double>() / 60.0;
+
+        const auto iterator_send_max_retries =
+            json.find("send_max_retries");
+        if (iterator_send_max_retries != json.end())
+            ohmyarch::send_limits.max_retries =
+                iterator_send_max_retries.value();
+    } catch (const std::exception &error) {
+        std::cerr << "❌ json: " << error.what() << std::endl;
+
+        return 1;
+    }
+
+    if (ohmyarch::polling_timeout < 0 || ohmyarch::polling_limit < 1 ||
+        ohmyarch::polling_limit > 100) {
+        std::cerr << "❌ polling_timeout must be >= 0 and polling_limit must "
+                     "be in [1, 100]"
+                  << std::endl;
+
+        return 1;
+    }
+
+    if (ohmyarch::update_offset_sync_interval.count() < 0 ||
+        ohmyarch::stale_update_age.count() < 0) {
+        std::cerr << "❌ update_offset_sync_interval and stale_update_age "
+                     "must be >= 0"
+                  << std::endl;
+
+        return 1;
+    }
+
+    if (ohmyarch::max_connections_per_host == 0) {
+        std::cerr << "❌ max_connections_per_host must be > 0" << std::endl;
+
+        return 1;
+    }
+
+    // A pool that can't fill up past its watermark would refill forever.
+    if (ohmyarch::prefetch_low_watermark == 0 ||
+        ohmyarch::prefetch_low_watermark >= ohmyarch::prefetch_capacity) {
+        std::cerr << "❌ prefetch_low_watermark must be > 0 and < "
+                     "prefetch_capacity"
+                  << std::endl;
+
+        return 1;
+    }
+
+    if (ohmyarch::send_limits.global_per_second <= 0.0 ||
+        ohmyarch::send_limits.private_per_second <= 0.0 ||
+        ohmyarch::send_limits.group_per_second <= 0.0) {
+        std::cerr << "❌ send rates must be > 0" << std::endl;
+
+        return 1;
+    }
+
+    for (const auto &bot : ohmyarch::bots)
+        if (!bot.webhook.listen_uri.empty() &&
+            bot.webhook.secret_token.empty()) {
+            std::cerr << "❌ webhook_listen needs a webhook_secret_token"
+                      << std::endl;
+
+            return 1;
+        }
+
+    for (const auto &bot : ohmyarch::bots)
+        if (bot.webhook.certificate.empty() !=
+            bot.webhook.private_key.empty()) {
+            std::cerr << "❌ webhook_certificate and webhook_private_key go "
+                         "together"
+                      << std::endl;
+
+            return 1;
+        }
+
+    if (ohmyarch::webhook_max_connections < 1 ||
+        ohmyarch::webhook_max_connections > 100) {
+        std::cerr << "❌ webhook_max_connections must be in [1, 100]"
+                  << std::endl;
+
+        return 1;
+    }
+
+    for (const auto &policy : ohmyarch::upstream_policies)
+        if (policy.deadline.count() < 0) {
+            std::cerr << "❌ upstream_deadlines must be >= 0" << std::endl;
+
+            return 1;
+        }
+
+    if (ohmyarch::hedge_min_delay.count() < 0 ||
+        ohmyarch::breaker_limits.window == 0 ||
+        ohmyarch::breaker_limits.failure_rate <= 0.0 ||
+        ohmyarch::breaker_limits.failure_rate > 1.0 ||
+        ohmyarch::breaker_limits.cooldown.count() < 0) {
+        std::cerr << "❌ hedge_min_delay and circuit_breaker_cooldown must be "
+                     ">= 0, circuit_breaker_window > 0 and "
+                     "circuit_breaker_failure_rate in (0, 1]"
+                  << std::endl;
+
+        return 1;
+    }
+
+    if (ohmyarch::trace_sample_rate < 0.0 ||
+        ohmyarch::trace_sample_rate > 1.0 ||
+        ohmyarch::trace_buffer_spans == 0) {
+        std::cerr << "❌ trace_sample_rate must be in [0, 1] and "
+                     "trace_buffer_spans must be > 0"
+                  << std::endl;
+
+        return 1;
+    }
+
+    if (ohmyarch::bots.size() > 256) {
+        std::cerr << "❌ at most 256 bots are supported" << std::endl;
+
+        return 1;
+    }
+
+    const bool shard_worker = map.count("shard") != 0;
+    const bool shard_ingress = !shard_worker && ohmyarch::shard_workers != 0;
+
+    if (shard_worker) {
+        if (shard_socket < 0 || shard_index >= ohmyarch::shard_workers) {
+            std::cerr << "❌ --shard needs --shard-socket and an index below "
+                         "shard_workers"
+                      << std::endl;
+
+            return 1;
+        }
+
+        // Updates are the ingress's; the chats are split between the workers,
+        // and so is each bot's share of the flood limit.
+        for (auto &bot : ohmyarch::bots) {
+            bot.update_offset_path.clear();
+            bot.webhook = ohmyarch::webhook::options();
+            bot.webhook_url.clear();
+        }
+        ohmyarch::send_limits.global_per_second /= ohmyarch::shard_workers;
+
+        const std::string suffix = "-shard-" + std::to_string(shard_index);
+        ohmyarch::local_backend_options.directory += suffix;
+        if (!ohmyarch::run_cpp_cache_path.empty())
+            ohmyarch::run_cpp_cache_path += suffix;
+        ohmyarch::trace_path += suffix;
+    }
+
+    const auto &local = ohmyarch::local_backend_options;
+    if (local.compile_limits.cpu_seconds == 0 ||
+        local.run_limits.cpu_seconds == 0 ||
+        local.run_limits.memory_bytes == 0 ||
+        local.run_limits.output_bytes == 0) {
+        std::cerr << "❌ local_compile_timeout, local_run_timeout, "
+                     "local_memory_limit and local_output_limit must be > 0"
+                  << std::endl;
+
+        return 1;
+    }
+
+    for (const auto &path : local.toolchain)
+        if (path.empty() || path[0] != '/') {
+            std::cerr << "❌ local_toolchain_paths must be absolute"
+                      << std::endl;
+
+            return 1;
+        }
+
+    // The workers are forked here, before the logger and the HTTP clients
+    // start their threads.
+    std::unique_ptr<ohmyarch::local_backend> local_backend;
+    if (ohmyarch::run_cpp_backend_name == "local" && !shard_ingress)
+        try {
+            local_backend.reset(new ohmyarch::local_backend(local));
+        } catch (const std::exception &error) {
+            std::cerr << "❌ local_backend: " << error.what() << std::endl;
+
+            return 1;
+        }
+
+    ohmyarch::polling_client_config = ohmyarch::client_config;
+    ohmyarch::polling_client_config.set_timeout(
+        std::chrono::seconds(ohmyarch::polling_timeout + 10));
+
     spdlog::set_async_mode(8192);
 
     try {
+        // Every shard worker logs to a file of its own.
+        std::string log_path = json.at("log_path");
+        if (shard_worker)
+            log_path += "-shard-" + std::to_string(shard_index);
+
         std::vector<spdlog::sink_ptr> sinks{
             std::make_shared<spdlog::sinks::ansicolor_sink>(
                 std::make_shared<spdlog::sinks::stdout_sink_mt>()),
             std::make_shared<spdlog::sinks::rotating_file_sink_mt>(
-                json.at("log_path"), "txt", 1024 * 1024 * 5, 0)};
+                log_path, "txt", 1024 * 1024 * 5, 0)};
         auto combined_logger = std::make_shared<spdlog::logger>(
             "logger", sinks.begin(), sinks.end());
         combined_logger->flush_on(spdlog::level::err);
@@ -237,197 +1097,130 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    std::signal(SIGINT, signal_handler);
+    // Ctrl-C reaches the whole process group; the ingress shuts its workers
+    // down itself.
+    std::signal(SIGINT, shard_worker ? SIG_IGN : signal_handler);
 
-    const auto bot_username = ohmyarch::get_me();
-    if (!bot_username)
-        return 1;
+    // SIGUSR1 writes the spans of the process; the ingress and each shard
+    // worker have their own.
+    std::signal(SIGUSR1, trace_signal_handler);
 
-    const std::string &username = bot_username.value();
+    std::unique_ptr<ohmyarch::trace_exporter> trace_exporter;
+    if (ohmyarch::trace_sample_rate > 0.0)
+        trace_exporter.reset(new ohmyarch::trace_exporter(
+            ohmyarch::trace_path, ohmyarch::trace_file_format));
 
-    const std::string quote_command = "/quote@" + username;
-    const std::string joke_command = "/joke@" + username;
-    const std::string funny_pics_command = "/funny_pics@" + username;
-    const std::string girl_pics_command = "/girl_pics@" + username;
-    const std::string run_cpp_command = "/run_cpp@" + username;
-    const std::string about_command = "/about@" + username;
+    if (local_backend) {
+        if (!local_backend->precompiled())
+            spdlog::get("logger")->warn(
+                "⚠️ local_backend: no precompiled header, compiling slower");
 
-    spdlog::get("logger")->info("🤖️ @{} is running 😉", username);
-    spdlog::get("logger")->flush();
+        spdlog::get("logger")->info("ℹ️ /run_cpp runs on this machine: {}",
+                                    local_backend->command());
 
-    while (keep_running) {
-        const auto updates = ohmyarch::get_updates();
-        if (updates)
-            for (const auto &update : updates.value()) {
-                const auto &message = update.message();
-                const auto &edited_message = update.edited_message();
-                if (message) {
-                    const auto &entities = message->entities();
-                    if (entities) {
-                        const std::u16string text =
-                            utility::conversions::utf8_to_utf16(
-                                message->text().value());
-
-                        std::vector<class message> messages;
-
-                        for (const auto &entity : entities.value())
-                            if (entity.type() == "bot_command") {
-                                const std::string command_text =
-                                    utility::conversions::utf16_to_utf8(
-                                        text.substr(entity.offset(),
-                                                    entity.length()));
-                                if (command_text == "/quote" ||
-                                    command_text == quote_command) {
-                                    messages.emplace_back(bot_command::quote);
-                                } else if (command_text == "/joke" ||
-                                           command_text == joke_command) {
-                                    messages.emplace_back(bot_command::joke);
-                                } else if (command_text == "/funny_pics" ||
-                                           command_text == funny_pics_command) {
-                                    messages.emplace_back(
-                                        bot_command::funny_pics);
-                                } else if (command_text == "/girl_pics" ||
-                                           command_text == girl_pics_command) {
-                                    messages.emplace_back(
-                                        bot_command::girl_pics);
-                                } else if (command_text == "/run_cpp" ||
-                                           command_text == run_cpp_command) {
-                                    if (entity.offset() == 0) {
-                                        const std::size_t entities_size =
-                                            entities->size();
-                                        if (entities_size > 1) {
-                                            bool code_or_pre = true;
-
-                                            std::string code;
-
-                                            for (int index = 1;
-                                                 index < entities_size;
-                                                 ++index) {
-                                                const auto &code_entity =
-                                                    entities->at(index);
-                                                if (code_entity.type() ==
-                                                        "code" ||
-                                                    code_entity.type() ==
-                                                        "pre") {
-                                                    code +=
-                                                        utility::conversions::
-                                                            utf16_to_utf8(text.substr(
-                                                                code_entity
-                                                                    .offset(),
-                                                                code_entity
-                                                                    .length())) +
-                                                        '\n';
-                                                } else {
-                                                    code_or_pre = false;
-
-                                                    break;
-                                                }
-                                            }
-
-                                            if (code_or_pre)
-                                                messages.emplace_back(
-                                                    bot_command::run_cpp,
-                                                    message->id(),
-                                                    std::move(code));
-                                        }
-
-                                        break;
-                                    }
-                                } else if (command_text == "/about" ||
-                                           command_text == about_command) {
-                                    messages.emplace_back(bot_command::about);
-                                }
-                            }
-
-                        if (messages.empty())
-                            continue;
-
-                        const std::int64_t chat_id = message->chat().id();
-
-                        std::unique_lock<std::mutex> lock(map_mutex);
-                        const auto pair = message_queue_map.emplace(
-                            chat_id, std::make_shared<message_queue>());
-                        lock.unlock();
-
-                        auto &queue = pair.first->second;
-                        queue->push(messages.begin(), messages.end());
-
-                        if (pair.second) {
-                            std::thread consumer_thread(consumer, chat_id,
-                                                        queue);
-                            consumer_thread.detach();
-                        }
-                    }
-                } else if (edited_message) {
-                    const auto &entities = edited_message->entities();
-                    if (entities) {
-                        const std::size_t entities_size = entities->size();
-                        if (entities_size > 1) {
-                            const auto &command_entity = entities->front();
-                            if (command_entity.offset() == 0 &&
-                                command_entity.type() == "bot_command") {
-                                const std::u16string text =
-                                    utility::conversions::utf8_to_utf16(
-                                        edited_message->text().value());
-                                const std::string command_text =
-                                    utility::conversions::utf16_to_utf8(
-                                        text.substr(0,
-                                                    command_entity.length()));
-                                if (command_text == "/run_cpp" ||
-                                    command_text == run_cpp_command) {
-                                    bool code_or_pre = true;
-
-                                    std::string code;
-
-                                    for (int index = 1; index < entities_size;
-                                         ++index) {
-                                        const auto &code_entity =
-                                            entities->at(index);
-                                        if (code_entity.type() == "code" ||
-                                            code_entity.type() == "pre") {
-                                            code +=
-                                                utility::conversions::
-                                                    utf16_to_utf8(text.substr(
-                                                        code_entity.offset(),
-                                                        code_entity.length())) +
-                                                '\n';
-                                        } else {
-                                            code_or_pre = false;
-
-                                            break;
-                                        }
-                                    }
-
-                                    if (code_or_pre) {
-                                        const std::int64_t chat_id =
-                                            edited_message->chat().id();
-
-                                        std::unique_lock<std::mutex> lock(
-                                            map_mutex);
-                                        const auto pair =
-                                            message_queue_map.emplace(
-                                                chat_id, std::make_shared<
-                                                             message_queue>());
-                                        lock.unlock();
-
-                                        auto &queue = pair.first->second;
-                                        queue->push({bot_command::run_cpp,
-                                                     edited_message->id(),
-                                                     std::move(code)});
-
-                                        if (pair.second) {
-                                            std::thread consumer_thread(
-                                                consumer, chat_id, queue);
-                                            consumer_thread.detach();
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
+        ohmyarch::set_run_cpp_backend(std::move(local_backend));
+    }
+
+    std::vector<std::unique_ptr<hosted_bot>> bots;
+
+    for (const auto &options : ohmyarch::bots) {
+        std::unique_ptr<hosted_bot> hosted(new hosted_bot);
+
+        try {
+            hosted->bot.reset(new ohmyarch::bot(bots.size(), options));
+        } catch (const std::exception &error) {
+            spdlog::get("logger")->error("❌ bot: {}", error.what());
+
+            return 1;
+        }
+
+        const auto username = ohmyarch::get_me(*hosted->bot);
+        if (!username)
+            return 1;
+
+        hosted->username = username.value();
+        hosted->commands.reset(
+            new ohmyarch::command_registry(username.value()));
+
+        bots.push_back(std::move(hosted));
+    }
+
+    // Declared before the metrics endpoint, which reads them.
+    std::unique_ptr<ohmyarch::shard_router> router;
+    std::unique_ptr<ohmyarch::executor> executor;
+
+    if (shard_ingress) {
+        try {
+            router.reset(new ohmyarch::shard_router(
+                "/proc/self/exe", {"--config", path_to_config},
+                ohmyarch::shard_workers));
+        } catch (const std::exception &error) {
+            spdlog::get("logger")->error("❌ shard_router: {}", error.what());
+
+            return 1;
+        }
+
+        ohmyarch::register_metric(
+            "ohmyarch_shard_unfinished_commands",
+            "Commands handed to shard workers and not yet done with.",
+            ohmyarch::metric_type::gauge,
+            [&router] { return router->pending(); });
+
+        spdlog::get("logger")->info("ℹ️ {} shard workers are running",
+                                    router->size());
+    } else {
+        ohmyarch::prefetch_jokes();
+        ohmyarch::prefetch_funny_pics();
+        ohmyarch::prefetch_girl_pics();
+
+        executor.reset(new ohmyarch::executor(ohmyarch::worker_threads,
+                                              ohmyarch::queue_capacity,
+                                              ohmyarch::queue_overload_policy));
+
+        spdlog::get("logger")->info("ℹ️ {} worker threads are running",
+                                    executor->size());
     }
 
-    spdlog::get("logger")->info("🤖️ @{} stopped 😴", username);
+    // Shard workers would all want the same port.
+    if (shard_worker) {
+        serve_shard(std::make_shared<ohmyarch::shard_inbox>(shard_socket),
+                    *executor, bots);
+
+        log_statistics(*executor);
+        spdlog::get("logger")->info("ℹ️ shard worker {} stopped 😴",
+                                    shard_index);
+
+        return 0;
+    }
+
+    if (executor)
+        register_metrics(*executor);
+
+    std::unique_ptr<ohmyarch::metrics_endpoint> metrics_endpoint;
+    if (!ohmyarch::metrics_listen.empty())
+        try {
+            metrics_endpoint.reset(
+                new ohmyarch::metrics_endpoint(ohmyarch::metrics_listen));
+        } catch (const std::exception &error) {
+            spdlog::get("logger")->error("❌ metrics_endpoint: {}",
+                                         error.what());
+
+            return 1;
+        }
+
+    if (router)
+        return serve_updates(bots, [&router](hosted_bot &hosted,
+                                             chat_command &command) {
+            route(*router, hosted, command);
+        });
+
+    const int status = serve_updates(
+        bots, [&executor](hosted_bot &hosted, chat_command &command) {
+            post(*executor, hosted, command.chat_id, command.command,
+                 command.trace_id);
+        });
+
+    log_statistics(*executor);
+
+    return status;
 }
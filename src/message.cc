@@ -4,23 +4,35 @@
 // license information.
 //
 
+#include "bot.h"
+#include "bot_request.h"
 #include "config.h"
+#include "http_pool.h"
 #include "message.h"
+#include "send_scheduler.h"
+#include "trace.h"
+#include <boost/algorithm/string/predicate.hpp>
+#include <cstring>
 #include <nlohmann/json.hpp>
 #include <spdlog/spdlog.h>
 
 namespace ohmyarch {
-static std::int32_t last_update_id = -1;
+static send_scheduler &scheduler() {
+    static send_scheduler scheduler(send_limits);
 
-std::experimental::optional<std::string> get_me() {
-    web::http::client::http_client client(api_uri + "getMe", client_config);
+    return scheduler;
+}
+
+std::size_t pending_sends() { return scheduler().pending(); }
 
+std::experimental::optional<std::string> get_me(const bot &bot) {
     try {
-        nlohmann::json json =
-            nlohmann::json::parse(client.request(web::http::methods::GET)
-                                      .get()
-                                      .extract_string()
-                                      .get());
+        nlohmann::json json = nlohmann::json::parse(
+            pooled_request(upstream::telegram, telegram_uri, client_config,
+                           bot_request().to_http_request(bot.method("getMe")))
+                .get()
+                .extract_string()
+                .get());
 
         if (!json.at("ok").get<bool>()) {
             spdlog::get("logger")->error(
@@ -38,135 +50,699 @@ std::experimental::optional<std::string> get_me() {
     }
 }
 
-std::experimental::optional<std::vector<update>> get_updates() {
-    web::uri_builder builder(api_uri + "getUpdates");
-
-    if (last_update_id != -1)
-        builder.append_query("offset", last_update_id);
-
-    web::http::client::http_client client(builder.to_uri(), client_config);
-
-    std::vector<update> updates;
-
+// Makes a Bot API call whose result doesn't matter beyond its success.
+static bool call(const char *name, web::http::http_request request) {
     try {
-        nlohmann::json json =
-            nlohmann::json::parse(client.request(web::http::methods::GET)
-                                      .get()
-                                      .extract_string()
-                                      .get());
+        const nlohmann::json json = nlohmann::json::parse(
+            pooled_request(upstream::telegram, telegram_uri, client_config,
+                           std::move(request))
+                .get()
+                .extract_string()
+                .get());
 
         if (!json.at("ok").get<bool>()) {
             spdlog::get("logger")->error(
-                "get_updates: {}",
+                "❌ {}: {}", name,
                 json.at("description")
                     .get_ref<const nlohmann::json::string_t &>());
 
-            return {};
+            return false;
         }
 
-        for (const auto &update_object : json.at("result")) {
-            update update;
-            update.update_id_ = update_object.at("update_id");
+        return true;
+    } catch (const std::exception &error) {
+        spdlog::get("logger")->error("❌ {}: {}", name, error.what());
 
-            bool edited = false;
+        return false;
+    }
+}
 
-            const auto iterator_message = update_object.find("message");
-            const auto iterator_edited_message =
-                update_object.find("edited_message");
+// Fills an update_batch straight from the getUpdates response, without
+// building a DOM. An update without a bot_command is dropped when its object
+// ends, and the text it copied into the batch buffer is given back. With
+// single_update the document is one Update object, as posted to a webhook.
+class update_parser : public nlohmann::json_sax<nlohmann::json> {
+  public:
+    // Decoded JSON strings are never longer than their encoded form, so a
+    // buffer as large as the response holds every text.
+    explicit update_parser(std::size_t response_size,
+                           bool single_update = false)
+        : capacity_(response_size), single_update_(single_update),
+          ok_(single_update) {
+        batch_.buffer_.reset(new char[capacity_ == 0 ? 1 : capacity_]);
+        frames_.reserve(8);
+    }
 
-            auto iterator = update_object.end();
-            if (iterator_message != update_object.end()) {
-                iterator = iterator_message;
-            } else if (iterator_edited_message != update_object.end()) {
-                iterator = iterator_edited_message;
+    bool ok() const { return ok_; }
+    const std::string &description() const { return description_; }
+    const std::string &error() const { return error_; }
+    std::int32_t max_update_id() const { return max_update_id_; }
 
-                edited = true;
-            }
+    update_batch release() { return std::move(batch_); }
 
-            if (iterator != update_object.end()) {
-                message message;
+    bool null() override { return true; }
 
-                const auto &message_object = iterator.value();
-                message.id_ = message_object.at("message_id");
+    bool boolean(bool value) override {
+        if (top() == frame::root && field_ == field::ok)
+            ok_ = value;
 
-                const auto &chat_object = message_object.at("chat");
-                message.chat_.id_ = chat_object.at("id");
+        return true;
+    }
 
-                const auto iterator_text = message_object.find("text");
-                if (iterator_text != message_object.end())
-                    message.text_ =
-                        iterator_text.value()
-                            .get_ref<const nlohmann::json::string_t &>();
+    bool number_integer(number_integer_t value) override {
+        return integer(value);
+    }
 
-                const auto iterator_entities = message_object.find("entities");
-                if (iterator_entities != message_object.end()) {
-                    std::vector<message_entity> entities;
+    bool number_unsigned(number_unsigned_t value) override {
+        return integer(static_cast<std::int64_t>(value));
+    }
 
-                    for (const auto &entity_object : iterator_entities.value())
-                        entities.emplace_back(entity_object.at("type"),
-                                              entity_object.at("offset"),
-                                              entity_object.at("length"));
+    bool number_float(number_float_t, const string_t &) override {
+        return true;
+    }
 
-                    message.entities_.emplace(std::move(entities));
+    bool string(string_t &value) override {
+        switch (top()) {
+        case frame::root:
+            if (field_ == field::description)
+                description_ = std::move(value);
+            break;
+        case frame::message:
+            if (field_ == field::text) {
+                if (used_ + value.size() > capacity_) {
+                    error_ = "text exceeds the batch buffer";
+
+                    return false;
                 }
 
-                if (edited)
-                    update.edited_message_.emplace(std::move(message));
+                char *text = batch_.buffer_.get() + used_;
+                std::memcpy(text, value.data(), value.size());
+                used_ += value.size();
+
+                message_.text_ = boost::string_view(text, value.size());
+            }
+            break;
+        case frame::entity:
+            if (field_ == field::type) {
+                if (value == "bot_command")
+                    entity_type_ = entity_type::bot_command;
+                else if (value == "code")
+                    entity_type_ = entity_type::code;
+                else if (value == "pre")
+                    entity_type_ = entity_type::pre;
                 else
-                    update.message_.emplace(std::move(message));
+                    entity_type_ = entity_type::other;
             }
+            break;
+        default:
+            break;
+        }
 
-            updates.emplace_back(std::move(update));
+        return true;
+    }
+
+    bool binary(binary_t &) override { return true; }
+
+    bool start_object(std::size_t) override {
+        switch (top()) {
+        case frame::none:
+            if (single_update_)
+                begin_update();
+            else
+                frames_.push_back(frame::root);
+            break;
+        case frame::result:
+            begin_update();
+            break;
+        case frame::update:
+            if (field_ == field::message || field_ == field::edited_message) {
+                frames_.push_back(frame::message);
+                in_message_ = true;
+                edited_ = field_ == field::edited_message;
+                message_.id_ = 0;
+                message_.date_ = 0;
+                message_.chat_.id_ = 0;
+                message_.text_ = {};
+                message_.entities_.clear();
+            } else {
+                frames_.push_back(frame::ignored);
+            }
+            break;
+        case frame::message:
+            frames_.push_back(field_ == field::chat ? frame::chat
+                                                    : frame::ignored);
+            break;
+        case frame::entities:
+            frames_.push_back(frame::entity);
+            entity_type_ = entity_type::other;
+            entity_offset_ = 0;
+            entity_length_ = 0;
+            break;
+        default:
+            frames_.push_back(frame::ignored);
+            break;
         }
 
-        if (updates.empty())
-            return {};
+        return true;
+    }
 
-        last_update_id = updates.back().update_id() + 1;
+    bool key(string_t &value) override {
+        if (value == "ok")
+            field_ = field::ok;
+        else if (value == "description")
+            field_ = field::description;
+        else if (value == "result")
+            field_ = field::result;
+        else if (value == "update_id")
+            field_ = field::update_id;
+        else if (value == "message")
+            field_ = field::message;
+        else if (value == "edited_message")
+            field_ = field::edited_message;
+        else if (value == "message_id")
+            field_ = field::message_id;
+        else if (value == "date" || value == "edit_date")
+            field_ = field::date;
+        else if (value == "chat")
+            field_ = field::chat;
+        else if (value == "id")
+            field_ = field::id;
+        else if (value == "text")
+            field_ = field::text;
+        else if (value == "entities")
+            field_ = field::entities;
+        else if (value == "offset")
+            field_ = field::offset;
+        else if (value == "length")
+            field_ = field::length;
+        else if (value == "type")
+            field_ = field::type;
+        else
+            field_ = field::other;
 
-        return std::move(updates);
-    } catch (const std::exception &error) {
-        spdlog::get("logger")->error("❌ get_updates: {}", error.what());
+        return true;
+    }
+
+    bool end_object() override {
+        const frame ended = top();
+        frames_.pop_back();
+
+        if (ended == frame::entity) {
+            message_.entities_.emplace_back(entity_type_, entity_offset_,
+                                            entity_length_);
+            if (entity_type_ == entity_type::bot_command)
+                has_command_ = true;
+        } else if (ended == frame::update) {
+            finish_update();
+        }
+
+        return true;
+    }
+
+    bool start_array(std::size_t) override {
+        if (top() == frame::root && field_ == field::result)
+            frames_.push_back(frame::result);
+        else if (top() == frame::message && field_ == field::entities)
+            frames_.push_back(frame::entities);
+        else
+            frames_.push_back(frame::ignored);
+
+        return true;
+    }
+
+    bool end_array() override {
+        frames_.pop_back();
+
+        return true;
+    }
+
+    bool parse_error(std::size_t, const std::string &,
+                     const nlohmann::detail::exception &error) override {
+        error_ = error.what();
+
+        return false;
+    }
+
+  private:
+    enum class frame : std::uint8_t {
+        none,
+        root,
+        result,
+        update,
+        message,
+        chat,
+        entities,
+        entity,
+        ignored
+    };
+
+    enum class field : std::uint8_t {
+        ok,
+        description,
+        result,
+        update_id,
+        message,
+        edited_message,
+        message_id,
+        date,
+        chat,
+        id,
+        text,
+        entities,
+        offset,
+        length,
+        type,
+        other
+    };
+
+    frame top() const { return frames_.empty() ? frame::none : frames_.back(); }
+
+    bool integer(std::int64_t value) {
+        switch (top()) {
+        case frame::update:
+            if (field_ == field::update_id)
+                update_id_ = static_cast<std::int32_t>(value);
+            break;
+        case frame::message:
+            if (field_ == field::message_id)
+                message_.id_ = static_cast<std::int32_t>(value);
+            else if (field_ == field::date)
+                message_.date_ = std::max(message_.date_, value);
+            break;
+        case frame::chat:
+            if (field_ == field::id)
+                message_.chat_.id_ = value;
+            break;
+        case frame::entity:
+            if (field_ == field::offset)
+                entity_offset_ = static_cast<std::int32_t>(value);
+            else if (field_ == field::length)
+                entity_length_ = static_cast<std::int32_t>(value);
+            break;
+        default:
+            break;
+        }
+
+        return true;
+    }
+
+    void begin_update() {
+        frames_.push_back(frame::update);
+        update_id_ = 0;
+        in_message_ = false;
+        has_command_ = false;
+        mark_ = used_;
+    }
+
+    void finish_update() {
+        max_update_id_ = std::max(max_update_id_, update_id_);
+
+        if (!in_message_ || !has_command_) {
+            used_ = mark_;
+
+            return;
+        }
+
+        update update;
+        update.update_id_ = update_id_;
+        if (edited_)
+            update.edited_message_.emplace(std::move(message_));
+        else
+            update.message_.emplace(std::move(message_));
+
+        batch_.updates_.emplace_back(std::move(update));
+    }
+
+    update_batch batch_;
+    const std::size_t capacity_;
+    const bool single_update_;
+    std::size_t used_ = 0;
+    std::size_t mark_ = 0;
+
+    std::vector<frame> frames_;
+    field field_ = field::other;
+
+    bool ok_;
+    std::string description_;
+    std::string error_;
+    std::int32_t max_update_id_ = -1;
+
+    std::int32_t update_id_ = 0;
+    bool in_message_ = false;
+    bool edited_ = false;
+    bool has_command_ = false;
+    message message_;
+
+    entity_type entity_type_ = entity_type::other;
+    std::int32_t entity_offset_ = 0;
+    std::int32_t entity_length_ = 0;
+};
+
+pplx::task<void> get_updates(bot &bot, const update_handler &handler) {
+    bot_request request(96);
+
+    if (bot.update_offset() != -1)
+        request.field("offset", bot.update_offset());
+    request.field("limit", polling_limit)
+        .field("timeout", polling_timeout)
+        .begin_array("allowed_updates")
+        .element("message")
+        .element("edited_message")
+        .end_array();
+
+    return pooled_request(upstream::telegram_polling, telegram_uri,
+                          polling_client_config,
+                          request.to_http_request(bot.method("getUpdates")))
+        .then([](web::http::http_response response) {
+            return response.extract_string();
+        })
+        .then([&bot, handler](pplx::task<std::string> body) {
+            try {
+                std::int32_t max_update_id = -1;
+                const auto batch = parse_updates(body.get(), max_update_id);
+
+                // Skipped updates move the offset too.
+                if (max_update_id != -1)
+                    bot.advance_update_offset(max_update_id + 1);
+
+                if (batch)
+                    handler(batch.value());
+            } catch (const std::exception &error) {
+                spdlog::get("logger")->error("❌ get_updates: {}",
+                                             error.what());
+            }
+        });
+}
+
+std::experimental::optional<update_batch>
+parse_updates(const std::string &body, std::int32_t &max_update_id) {
+    update_parser parser(body.size());
+
+    if (!nlohmann::json::sax_parse(body, &parser)) {
+        spdlog::get("logger")->error("❌ get_updates: {}", parser.error());
+
+        return {};
+    }
+
+    if (!parser.ok()) {
+        spdlog::get("logger")->error("get_updates: {}", parser.description());
 
         return {};
     }
+
+    max_update_id = parser.max_update_id();
+
+    update_batch batch = parser.release();
+    if (batch.empty())
+        return {};
+
+    return std::move(batch);
 }
 
-void send_message(std::int64_t chat_id, const std::string &text,
-                  std::experimental::optional<std::int32_t> rely_to,
-                  std::experimental::optional<formatting_options> parse_mode) {
-    web::uri_builder builder(api_uri + "sendMessage");
-    builder.append_query("chat_id", chat_id);
-    builder.append_query("text", text);
-    if (parse_mode) {
-        if (parse_mode.value() == formatting_options::markdown_style)
-            builder.append_query("parse_mode", "Markdown");
-        else
-            builder.append_query("parse_mode", "HTML");
+std::experimental::optional<update_batch>
+parse_update(const std::string &body) {
+    update_parser parser(body.size(), true);
+
+    if (!nlohmann::json::sax_parse(body, &parser)) {
+        spdlog::get("logger")->error("❌ parse_update: {}", parser.error());
+
+        return {};
     }
-    if (rely_to)
-        builder.append_query("reply_to_message_id", rely_to.value());
 
-    web::http::client::http_client client(builder.to_uri(), client_config);
+    update_batch batch = parser.release();
+    if (batch.empty())
+        return {};
 
-    try {
-        client.request(web::http::methods::GET).get();
-    } catch (const std::exception &error) {
-        spdlog::get("logger")->error("❌ send_message: {}", error.what());
+    return std::move(batch);
+}
+
+bool set_webhook(const bot &bot, const std::string &url,
+                 const std::string &secret_token,
+                 std::int32_t max_connections) {
+    bot_request request(url.size() + secret_token.size() + 128);
+    request.field("url", url).field("max_connections", max_connections);
+    if (!secret_token.empty())
+        request.field("secret_token", secret_token);
+    request.begin_array("allowed_updates")
+        .element("message")
+        .element("edited_message")
+        .end_array();
+
+    return call("set_webhook",
+                request.to_http_request(bot.method("setWebhook")));
+}
+
+bool delete_webhook(const bot &bot) {
+    return call("delete_webhook",
+                bot_request().to_http_request(bot.method("deleteWebhook")));
+}
+
+// The message_id of the message a send returned.
+static std::experimental::optional<std::int32_t>
+sent_message_id(const char *method, web::http::http_response response) {
+    const nlohmann::json json =
+        nlohmann::json::parse(response.extract_string().get());
+
+    if (!json.at("ok").get<bool>()) {
+        spdlog::get("logger")->error(
+            "❌ {}: {}", method,
+            json.at("description")
+                .get_ref<const nlohmann::json::string_t &>());
+
+        return {};
     }
+
+    return json.at("result").at("message_id").get<std::int32_t>();
+}
+
+static void set_parse_mode(
+    bot_request &request,
+    std::experimental::optional<formatting_options> parse_mode) {
+    if (!parse_mode)
+        return;
+
+    if (parse_mode.value() == formatting_options::markdown_style)
+        request.field("parse_mode", "Markdown");
+    else
+        request.field("parse_mode", "HTML");
 }
 
-void send_document(std::int64_t chat_id, const std::string &uri) {
-    web::uri_builder builder(api_uri + "sendDocument");
-    builder.append_query("chat_id", chat_id);
-    builder.append_query("document", uri);
+pplx::task<std::experimental::optional<std::int32_t>>
+reply_message(const bot &bot, std::int64_t chat_id, const std::string &text,
+              std::experimental::optional<std::int32_t> rely_to,
+              std::experimental::optional<formatting_options> parse_mode) {
+    // Replies to a command message go ahead of plain messages.
+    const send_priority priority =
+        rely_to ? send_priority::high : send_priority::normal;
+    const std::string method = bot.method("sendMessage");
+    const std::uint64_t trace = current_trace();
+    const auto started = trace_clock::now();
+
+    return scheduler()
+        .schedule(bot.index(), chat_id, priority,
+                  [method, chat_id, text, rely_to, parse_mode] {
+                      bot_request request(text.size() + 96);
+                      request.field("chat_id", chat_id).field("text", text);
+                      set_parse_mode(request, parse_mode);
+                      if (rely_to)
+                          request.field("reply_to_message_id",
+                                        rely_to.value());
+
+                      return pooled_request(upstream::telegram, telegram_uri,
+                                            client_config,
+                                            request.to_http_request(method));
+                  })
+        .then([chat_id, trace,
+               started](pplx::task<web::http::http_response> response)
+                  -> std::experimental::optional<std::int32_t> {
+            record_span(trace, "sendMessage", started, trace_clock::now(),
+                        chat_id);
+
+            try {
+                return sent_message_id("send_message", response.get());
+            } catch (const std::exception &error) {
+                spdlog::get("logger")->error("❌ send_message: {}",
+                                             error.what());
+
+                return {};
+            }
+        });
+}
 
-    web::http::client::http_client client(builder.to_uri(), client_config);
+pplx::task<void>
+send_message(const bot &bot, std::int64_t chat_id, const std::string &text,
+             std::experimental::optional<std::int32_t> rely_to,
+             std::experimental::optional<formatting_options> parse_mode) {
+    return reply_message(bot, chat_id, text, rely_to, parse_mode)
+        .then([](std::experimental::optional<std::int32_t>) {});
+}
 
-    try {
-        client.request(web::http::methods::GET).get();
-    } catch (const std::exception &error) {
-        spdlog::get("logger")->error("❌ send_document: {}", error.what());
+pplx::task<void>
+edit_message_text(const bot &bot, std::int64_t chat_id,
+                  std::int32_t message_id, const std::string &text,
+                  std::experimental::optional<formatting_options> parse_mode) {
+    const std::string method = bot.method("editMessageText");
+    const std::uint64_t trace = current_trace();
+    const auto started = trace_clock::now();
+
+    return scheduler()
+        .schedule(bot.index(), chat_id, send_priority::high,
+                  [method, chat_id, message_id, text, parse_mode] {
+                      bot_request request(text.size() + 96);
+                      request.field("chat_id", chat_id)
+                          .field("message_id", message_id)
+                          .field("text", text);
+                      set_parse_mode(request, parse_mode);
+
+                      return pooled_request(upstream::telegram, telegram_uri,
+                                            client_config,
+                                            request.to_http_request(method));
+                  })
+        .then([chat_id, trace,
+               started](pplx::task<web::http::http_response> response) {
+            record_span(trace, "editMessageText", started, trace_clock::now(),
+                        chat_id);
+
+            try {
+                const nlohmann::json json = nlohmann::json::parse(
+                    response.get().extract_string().get());
+
+                // Editing a message to the text it already has is an error,
+                // and not worth logging.
+                const auto &description = json.value("description", "");
+                if (!json.at("ok").get<bool>() &&
+                    description.find("not modified") == std::string::npos)
+                    spdlog::get("logger")->error("❌ edit_message_text: {}",
+                                                 description);
+            } catch (const std::exception &error) {
+                spdlog::get("logger")->error("❌ edit_message_text: {}",
+                                             error.what());
+            }
+        });
+}
+
+pplx::task<void> send_document(const bot &bot, std::int64_t chat_id,
+                               const std::string &uri) {
+    const std::string method = bot.method("sendDocument");
+    const std::uint64_t trace = current_trace();
+    const auto started = trace_clock::now();
+
+    return scheduler()
+        .schedule(bot.index(), chat_id, send_priority::low,
+                  [method, chat_id, uri] {
+                      bot_request request(uri.size() + 64);
+                      request.field("chat_id", chat_id).field("document", uri);
+
+                      return pooled_request(upstream::telegram, telegram_uri,
+                                            client_config,
+                                            request.to_http_request(method));
+                  })
+        .then([chat_id, trace,
+               started](pplx::task<web::http::http_response> response) {
+            record_span(trace, "sendDocument", started, trace_clock::now(),
+                        chat_id);
+
+            try {
+                response.get();
+            } catch (const std::exception &error) {
+                spdlog::get("logger")->error("❌ send_document: {}",
+                                             error.what());
+            }
+        });
+}
+
+// Sends up to 10 still images as one album. If Telegram rejects the album,
+// for example because one of the pictures can't be fetched, they are sent one
+// by one instead.
+static pplx::task<void> send_album(const bot &bot, std::int64_t chat_id,
+                                   std::vector<std::string> uris) {
+    const std::string method = bot.method("sendMediaGroup");
+    const std::uint64_t trace = current_trace();
+    const auto started = trace_clock::now();
+
+    return scheduler()
+        .schedule(bot.index(), chat_id, send_priority::low,
+                  [method, chat_id, uris] {
+                      std::size_t size_hint = 64;
+                      for (const auto &uri : uris)
+                          size_hint += uri.size() + 32;
+
+                      bot_request request(size_hint);
+                      request.field("chat_id", chat_id).begin_array("media");
+                      for (const auto &uri : uris)
+                          request.begin_object()
+                              .field("type", "photo")
+                              .field("media", uri)
+                              .end_object();
+                      request.end_array();
+
+                      return pooled_request(upstream::telegram, telegram_uri,
+                                            client_config,
+                                            request.to_http_request(method));
+                  })
+        .then([&bot, chat_id, uris, trace,
+               started](pplx::task<web::http::http_response> response) {
+            record_span(trace, "sendMediaGroup", started, trace_clock::now(),
+                        chat_id);
+
+            try {
+                const auto status = response.get().status_code();
+                if (status == web::http::status_codes::OK)
+                    return pplx::task_from_result();
+
+                spdlog::get("logger")->error("❌ send_album: HTTP {}", status);
+            } catch (const std::exception &error) {
+                spdlog::get("logger")->error("❌ send_album: {}",
+                                             error.what());
+            }
+
+            pplx::task<void> chain = pplx::task_from_result();
+            for (const auto &uri : uris)
+                chain = chain.then([&bot, chat_id, uri, trace] {
+                    const trace_scope scope(trace);
+
+                    return send_message(bot, chat_id, uri);
+                });
+
+            return chain;
+        });
+}
+
+pplx::task<void> send_pictures(const bot &bot, std::int64_t chat_id,
+                               const std::vector<std::string> &uris) {
+    // Split into runs of still images of at most 10, and single GIFs, in the
+    // original order.
+    std::vector<std::vector<std::string>> segments;
+    bool still_run = false;
+
+    for (const auto &uri : uris) {
+        const bool still = !boost::ends_with(uri, "gif");
+
+        if (!still || !still_run || segments.back().size() == 10)
+            segments.emplace_back();
+
+        segments.back().push_back(uri);
+        still_run = still;
     }
+
+    // Telegram shows messages in the order it handles the requests, so each
+    // segment waits for the previous one.
+    pplx::task<void> chain = pplx::task_from_result();
+    const std::uint64_t trace = current_trace();
+
+    for (auto &segment : segments)
+        chain = chain.then([&bot, chat_id, segment, trace] {
+            const trace_scope scope(trace);
+
+            if (boost::ends_with(segment.front(), "gif"))
+                return send_document(bot, chat_id, segment.front());
+
+            if (segment.size() == 1)
+                return send_message(bot, chat_id, segment.front());
+
+            return send_album(bot, chat_id, segment);
+        });
+
+    return chain;
 }
 }
@@ -0,0 +1,270 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#include "metrics.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <mutex>
+#include <spdlog/spdlog.h>
+#include <vector>
+
+namespace ohmyarch {
+std::size_t latency_histogram::index_of(std::uint64_t microseconds) {
+    if (microseconds < sub_buckets)
+        return static_cast<std::size_t>(microseconds);
+
+    const std::uint64_t largest = (std::uint64_t(1) << max_bits) - 1;
+    if (microseconds > largest)
+        microseconds = largest;
+
+    // The position of the highest set bit picks the power of two, the next
+    // sub_bucket_bits bits the bucket within it.
+    const std::size_t high_bit =
+        63 - static_cast<std::size_t>(__builtin_clzll(microseconds));
+    const std::size_t shift = high_bit - sub_bucket_bits;
+    const std::size_t sub =
+        static_cast<std::size_t>(microseconds >> shift) - sub_buckets;
+
+    return (shift + 1) * sub_buckets + sub;
+}
+
+std::uint64_t latency_histogram::upper_bound(std::size_t index) {
+    const std::size_t group = index / sub_buckets;
+    const std::uint64_t sub = index % sub_buckets;
+
+    if (group == 0)
+        return sub + 1;
+
+    return (sub_buckets + sub + 1) << (group - 1);
+}
+
+std::uint64_t latency_histogram::quantile_microseconds(double q) const {
+    const std::uint64_t total = count();
+    if (total == 0)
+        return 0;
+
+    // The rank of the quantile, counting from 1.
+    const std::uint64_t rank = std::max<std::uint64_t>(
+        1, static_cast<std::uint64_t>(q * static_cast<double>(total) + 0.5));
+
+    std::uint64_t cumulative = 0;
+    for (std::size_t index = 0; index < bucket_count; ++index) {
+        cumulative += bucket(index);
+        if (cumulative >= rank)
+            return upper_bound(index);
+    }
+
+    // Buckets and count are updated apart, so a racing record() may not be
+    // in the buckets yet.
+    return upper_bound(bucket_count - 1);
+}
+
+void latency_histogram::record(std::chrono::steady_clock::duration duration) {
+    const auto microseconds =
+        std::chrono::duration_cast<std::chrono::microseconds>(duration)
+            .count();
+    const std::uint64_t value =
+        microseconds < 0 ? 0 : static_cast<std::uint64_t>(microseconds);
+
+    buckets_[index_of(value)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+}
+
+namespace {
+const char *const command_names[] = {"quote",     "joke",    "funny_pics",
+                                     "girl_pics", "run_cpp", "about"};
+
+const char *const upstream_names[] = {"telegram", "telegram_polling",
+                                      "jandan",   "forismatic",
+                                      "coliru",   "local_compiler"};
+
+constexpr std::size_t command_count =
+    sizeof(command_names) / sizeof(command_names[0]);
+static_assert(sizeof(upstream_names) / sizeof(upstream_names[0]) ==
+                  upstream_count,
+              "an upstream without a name");
+
+struct upstream_metrics {
+    latency_histogram latency;
+    std::atomic<std::uint64_t> failures{0};
+};
+
+latency_histogram command_latency[command_count];
+upstream_metrics upstream_latency[upstream_count];
+
+struct registered_metric {
+    std::string name;
+    std::string help;
+    metric_type type;
+    std::function<double()> value;
+};
+
+std::mutex registry_mutex;
+std::vector<registered_metric> registry;
+
+// The bucket boundaries exported to Prometheus, in seconds. Each internal
+// bucket is counted under the first boundary not below its upper bound, so a
+// value may be counted one boundary too high by up to 1/32 of itself.
+const double boundaries[] = {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+                             0.1,   0.25,   0.5,   1.0,  2.5,   5.0,
+                             10.0,  30.0,   60.0};
+
+void render_histogram(std::string &text, const char *name, const char *label,
+                      const char *value, const latency_histogram &histogram) {
+    char line[256];
+
+    std::size_t index = 0;
+    std::uint64_t cumulative = 0;
+
+    for (const double boundary : boundaries) {
+        const auto limit = static_cast<std::uint64_t>(boundary * 1e6);
+        while (index < latency_histogram::bucket_count &&
+               latency_histogram::upper_bound(index) <= limit)
+            cumulative += histogram.bucket(index++);
+
+        std::snprintf(line, sizeof(line),
+                      "%s_bucket{%s=\"%s\",le=\"%g\"} %" PRIu64 "\n", name,
+                      label, value, boundary, cumulative);
+        text += line;
+    }
+
+    // The buckets beyond the last boundary. +Inf and _count come from the
+    // same sum, so neither is below a bucket read earlier while values are
+    // being recorded.
+    while (index < latency_histogram::bucket_count)
+        cumulative += histogram.bucket(index++);
+
+    std::snprintf(line, sizeof(line),
+                  "%s_bucket{%s=\"%s\",le=\"+Inf\"} %" PRIu64 "\n"
+                  "%s_sum{%s=\"%s\"} %.6f\n"
+                  "%s_count{%s=\"%s\"} %" PRIu64 "\n",
+                  name, label, value, cumulative, name, label, value,
+                  histogram.sum_microseconds() / 1e6, name, label, value,
+                  cumulative);
+    text += line;
+}
+
+void render_header(std::string &text, const char *name, const char *help,
+                   const char *type) {
+    text += "# HELP ";
+    text += name;
+    text += ' ';
+    text += help;
+    text += "\n# TYPE ";
+    text += name;
+    text += ' ';
+    text += type;
+    text += '\n';
+}
+}
+
+void record_command(bot_command command,
+                    std::chrono::steady_clock::duration duration) {
+    command_latency[static_cast<std::size_t>(command)].record(duration);
+}
+
+void record_upstream(upstream upstream,
+                     std::chrono::steady_clock::duration duration,
+                     bool failed) {
+    auto &metrics = upstream_latency[static_cast<std::size_t>(upstream)];
+
+    metrics.latency.record(duration);
+    if (failed)
+        metrics.failures.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::chrono::microseconds upstream_quantile(upstream upstream, double q,
+                                            std::uint64_t min_count) {
+    const auto &histogram =
+        upstream_latency[static_cast<std::size_t>(upstream)].latency;
+
+    if (histogram.count() < min_count)
+        return std::chrono::microseconds(0);
+
+    return std::chrono::microseconds(histogram.quantile_microseconds(q));
+}
+
+const char *upstream_name(upstream upstream) {
+    return upstream_names[static_cast<std::size_t>(upstream)];
+}
+
+void register_metric(const std::string &name, const std::string &help,
+                     metric_type type, std::function<double()> value) {
+    std::lock_guard<std::mutex> guard(registry_mutex);
+
+    registry.push_back({name, help, type, std::move(value)});
+}
+
+std::string render_metrics() {
+    std::string text;
+    text.reserve(32 * 1024);
+
+    render_header(text, "ohmyarch_command_duration_seconds",
+                  "Time from receiving a command to its last reply.",
+                  "histogram");
+    for (std::size_t i = 0; i < command_count; ++i)
+        render_histogram(text, "ohmyarch_command_duration_seconds", "command",
+                         command_names[i], command_latency[i]);
+
+    render_header(text, "ohmyarch_upstream_duration_seconds",
+                  "Duration of calls to upstream services.", "histogram");
+    for (std::size_t i = 0; i < upstream_count; ++i)
+        render_histogram(text, "ohmyarch_upstream_duration_seconds",
+                         "upstream", upstream_names[i],
+                         upstream_latency[i].latency);
+
+    render_header(text, "ohmyarch_upstream_failures_total",
+                  "Calls to upstream services that failed or didn't return "
+                  "2xx.",
+                  "counter");
+    for (std::size_t i = 0; i < upstream_count; ++i) {
+        char line[128];
+        std::snprintf(line, sizeof(line),
+                      "ohmyarch_upstream_failures_total{upstream=\"%s\"} "
+                      "%" PRIu64 "\n",
+                      upstream_names[i],
+                      upstream_latency[i].failures.load(
+                          std::memory_order_relaxed));
+        text += line;
+    }
+
+    std::lock_guard<std::mutex> guard(registry_mutex);
+
+    for (const auto &metric : registry) {
+        render_header(text, metric.name.c_str(), metric.help.c_str(),
+                      metric.type == metric_type::counter ? "counter"
+                                                          : "gauge");
+
+        char line[128];
+        std::snprintf(line, sizeof(line), "%s %.17g\n", metric.name.c_str(),
+                      metric.value());
+        text += line;
+    }
+
+    return text;
+}
+
+metrics_endpoint::metrics_endpoint(const std::string &listen_uri)
+    : listener_(listen_uri) {
+    listener_.support(
+        web::http::methods::GET, [](web::http::http_request request) {
+            request.reply(web::http::status_codes::OK, render_metrics(),
+                          "text/plain; version=0.0.4");
+        });
+
+    listener_.open().wait();
+}
+
+metrics_endpoint::~metrics_endpoint() {
+    try {
+        listener_.close().wait();
+    } catch (const std::exception &error) {
+        spdlog::get("logger")->error("❌ metrics_endpoint: {}", error.what());
+    }
+}
+}
@@ -0,0 +1,96 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#include "offset_store.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <spdlog/spdlog.h>
+#include <unistd.h>
+
+namespace ohmyarch {
+// Eleven digits and a newline hold any std::int32_t.
+static const std::size_t record_size = 12;
+
+offset_store::offset_store(const std::string &path,
+                           std::chrono::milliseconds sync_interval)
+    : path_(path), sync_interval_(sync_interval),
+      synced_(std::chrono::steady_clock::now()) {
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd_ == -1) {
+        spdlog::get("logger")->error("❌ offset_store: {}: {}", path,
+                                     std::strerror(errno));
+
+        return;
+    }
+
+    char record[record_size + 1] = {};
+    const ssize_t size = ::pread(fd_, record, record_size, 0);
+    if (size <= 0)
+        return;
+
+    char *end = nullptr;
+    const long offset = std::strtol(record, &end, 10);
+    if (end == record || *end != '\n' || offset < 0 || offset > INT32_MAX) {
+        spdlog::get("logger")->warn("⚠️ offset_store: {} is corrupt", path);
+
+        return;
+    }
+
+    offset_ = static_cast<std::int32_t>(offset);
+
+    spdlog::get("logger")->info("ℹ️ offset_store: resuming from update {}",
+                                offset_);
+}
+
+offset_store::~offset_store() {
+    if (fd_ == -1)
+        return;
+
+    flush();
+    ::close(fd_);
+}
+
+void offset_store::advance(std::int32_t offset) {
+    if (offset == offset_)
+        return;
+
+    offset_ = offset;
+
+    if (fd_ == -1)
+        return;
+
+    char record[record_size + 1];
+    std::snprintf(record, sizeof(record), "%011d\n", offset);
+
+    if (::pwrite(fd_, record, record_size, 0) !=
+        static_cast<ssize_t>(record_size)) {
+        spdlog::get("logger")->error("❌ offset_store: {}: {}", path_,
+                                     std::strerror(errno));
+
+        return;
+    }
+
+    dirty_ = true;
+
+    if (std::chrono::steady_clock::now() - synced_ >= sync_interval_)
+        flush();
+}
+
+void offset_store::flush() {
+    if (fd_ == -1 || !dirty_)
+        return;
+
+    if (::fdatasync(fd_) != 0)
+        spdlog::get("logger")->error("❌ offset_store: {}: {}", path_,
+                                     std::strerror(errno));
+
+    dirty_ = false;
+    synced_ = std::chrono::steady_clock::now();
+}
+}
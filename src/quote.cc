@@ -4,32 +4,39 @@
 // license information.
 //
 
+#include "config.h"
 #include "quote.h"
+#include "upstream_guard.h"
 #include <cpprest/http_client.h>
 #include <nlohmann/json.hpp>
 #include <spdlog/spdlog.h>
 
 namespace ohmyarch {
-std::experimental::optional<quote> get_quote() {
-    web::uri_builder builder("http://api.forismatic.com/api/1.0/");
+pplx::task<std::experimental::optional<quote>> get_quote() {
+    web::uri_builder builder("/api/1.0/");
     builder.append_query("method", "getQuote")
         .append_query("format", "json")
         .append_query("lang", "en");
 
-    web::http::client::http_client client(builder.to_uri());
+    web::http::http_request request(web::http::methods::GET);
+    request.set_request_uri(builder.to_uri());
 
-    try {
-        nlohmann::json json =
-            nlohmann::json::parse(client.request(web::http::methods::GET)
-                                      .get()
-                                      .extract_string()
-                                      .get());
+    return guarded_request(upstream::forismatic, forismatic_uri,
+                           std::move(request))
+        .then([](web::http::http_response response) {
+            return response.extract_string();
+        })
+        .then([](pplx::task<std::string> body)
+                  -> std::experimental::optional<quote> {
+            try {
+                nlohmann::json json = nlohmann::json::parse(body.get());
 
-        return quote(json.at("quoteAuthor"), json.at("quoteText"));
-    } catch (const std::exception &error) {
-        spdlog::get("logger")->error("❌ get_quote: {}", error.what());
+                return quote(json.at("quoteAuthor"), json.at("quoteText"));
+            } catch (const std::exception &error) {
+                spdlog::get("logger")->error("❌ get_quote: {}", error.what());
 
-        return {};
-    }
+                return {};
+            }
+        });
 }
 }
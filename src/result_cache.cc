@@ -0,0 +1,185 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#include "result_cache.h"
+#include <cstdio>
+#include <nlohmann/json.hpp>
+#include <openssl/evp.h>
+#include <spdlog/spdlog.h>
+
+namespace ohmyarch {
+result_cache::result_cache(std::size_t capacity, std::chrono::seconds ttl,
+                           std::string path)
+    : capacity_(capacity), ttl_(ttl), path_(std::move(path)) {
+    if (path_.empty() || capacity_ == 0)
+        return;
+
+    load();
+    compact();
+}
+
+result_cache::~result_cache() {
+    if (journal_.is_open())
+        compact();
+}
+
+// The command and the input are separated by a NUL so that moving text from
+// one to the other changes the key.
+std::string result_cache::key(const std::string &command,
+                              const std::string &input) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int size = 0;
+
+    EVP_MD_CTX *context = EVP_MD_CTX_create();
+    EVP_DigestInit_ex(context, EVP_sha256(), nullptr);
+    EVP_DigestUpdate(context, command.data(), command.size());
+    EVP_DigestUpdate(context, "", 1);
+    EVP_DigestUpdate(context, input.data(), input.size());
+    EVP_DigestFinal_ex(context, digest, &size);
+    EVP_MD_CTX_destroy(context);
+
+    static const char hex[] = "0123456789abcdef";
+
+    std::string key;
+    key.reserve(2 * size);
+    for (unsigned int i = 0; i < size; ++i) {
+        key += hex[digest[i] >> 4];
+        key += hex[digest[i] & 0xf];
+    }
+
+    return key;
+}
+
+std::experimental::optional<std::string>
+result_cache::find(const std::string &key) {
+    std::lock_guard<std::mutex> guard(mutex_);
+
+    const auto iterator = index_.find(key);
+    if (iterator == index_.end())
+        return {};
+
+    const auto position = iterator->second;
+    if (clock::now() - position->time > ttl_) {
+        entries_.erase(position);
+        index_.erase(iterator);
+
+        return {};
+    }
+
+    entries_.splice(entries_.begin(), entries_, position);
+
+    return position->output;
+}
+
+void result_cache::insert(const std::string &key, const std::string &output) {
+    if (capacity_ == 0)
+        return;
+
+    entry value{key, output, clock::now()};
+
+    std::lock_guard<std::mutex> guard(mutex_);
+
+    if (journal_.is_open()) {
+        append(value);
+
+        if (journal_lines_ >= 2 * capacity_) {
+            put(std::move(value));
+            compact();
+
+            return;
+        }
+    }
+
+    put(std::move(value));
+}
+
+void result_cache::put(entry value) {
+    const auto iterator = index_.find(value.key);
+    if (iterator != index_.end()) {
+        entries_.erase(iterator->second);
+        index_.erase(iterator);
+    }
+
+    entries_.push_front(std::move(value));
+    index_.emplace(entries_.front().key, entries_.begin());
+
+    if (entries_.size() > capacity_) {
+        index_.erase(entries_.back().key);
+        entries_.pop_back();
+    }
+}
+
+// Lines are in insertion order, so putting them one after another leaves the
+// newest entries in the cache. A line that doesn't parse, most likely one cut
+// short by a crash, is skipped.
+void result_cache::load() {
+    std::ifstream file(path_);
+    if (!file)
+        return;
+
+    const auto now = clock::now();
+
+    std::string line;
+    while (std::getline(file, line)) {
+        try {
+            const auto json = nlohmann::json::parse(line);
+
+            entry value{json.at("key").get<std::string>(),
+                        json.at("output").get<std::string>(),
+                        clock::time_point(std::chrono::seconds(
+                            json.at("time").get<std::int64_t>()))};
+            if (now - value.time <= ttl_)
+                put(std::move(value));
+        } catch (const std::exception &error) {
+            spdlog::get("logger")->warn("⚠️ result_cache: {}: {}", path_,
+                                        error.what());
+        }
+    }
+
+    spdlog::get("logger")->info("ℹ️ result_cache: {} entries from {}",
+                                entries_.size(), path_);
+}
+
+// Writes the live entries, oldest first, to a new file and moves it over the
+// old one, so a crash in between leaves one of the two intact.
+void result_cache::compact() {
+    journal_.close();
+    journal_lines_ = 0;
+
+    const std::string temporary = path_ + ".tmp";
+
+    journal_.open(temporary, std::ios::trunc);
+    for (auto iterator = entries_.rbegin(); iterator != entries_.rend();
+         ++iterator)
+        append(*iterator);
+    journal_.close();
+
+    if (!journal_ || std::rename(temporary.c_str(), path_.c_str()) != 0) {
+        spdlog::get("logger")->error("❌ result_cache: can't write {}",
+                                     path_);
+
+        return;
+    }
+
+    journal_.open(path_, std::ios::app);
+}
+
+void result_cache::append(const entry &value) {
+    const nlohmann::json json{
+        {"key", value.key},
+        {"output", value.output},
+        {"time", std::chrono::duration_cast<std::chrono::seconds>(
+                     value.time.time_since_epoch())
+                     .count()}};
+
+    // Compiler output isn't always valid UTF-8.
+    journal_ << json.dump(-1, ' ', false,
+                          nlohmann::json::error_handler_t::replace)
+             << '\n'
+             << std::flush;
+    ++journal_lines_;
+}
+}
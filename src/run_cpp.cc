@@ -4,31 +4,46 @@
 // license information.
 //
 
+#include "config.h"
+#include "result_cache.h"
 #include "run_cpp.h"
-#include <cpprest/http_client.h>
-#include <spdlog/spdlog.h>
 
 namespace ohmyarch {
-std::experimental::optional<std::string> run_cpp(const std::string &code) {
-    web::http::client::http_client client(
-        "http://coliru.stacked-crooked.com/compile");
-
-    web::json::value body_data;
-    body_data["cmd"] = web::json::value::string(
-        "g++ -std=c++1z -fconcepts -fgnu-tm -O3 -Wall -Wextra "
-        "-pedantic-errors main.cpp -pthread -lm -latomic -lstdc++fs && "
-        "./a.out");
-    body_data["src"] = web::json::value::string(code);
-
-    try {
-        return client.request(web::http::methods::POST, {}, body_data)
-            .get()
-            .extract_string()
-            .get();
-    } catch (const std::exception &error) {
-        spdlog::get("logger")->error("❌ run_cpp: {}", error.what());
-
-        return {};
-    }
+static std::unique_ptr<run_cpp_backend> &backend() {
+    static std::unique_ptr<run_cpp_backend> backend(new coliru_backend);
+
+    return backend;
+}
+
+static result_cache &cache() {
+    static result_cache cache(run_cpp_cache_capacity, run_cpp_cache_ttl,
+                              run_cpp_cache_path);
+
+    return cache;
+}
+
+void set_run_cpp_backend(std::unique_ptr<run_cpp_backend> backend) {
+    ohmyarch::backend() = std::move(backend);
+}
+
+pplx::task<std::experimental::optional<std::string>>
+run_cpp(const std::string &code, pplx::cancellation_token token) {
+    std::string key = result_cache::key(backend()->command(), code);
+
+    auto output = cache().find(key);
+    if (output)
+        return pplx::task_from_result(std::move(output));
+
+    return backend()->run(code, token).then(
+        [key](std::experimental::optional<run_cpp_output> output)
+            -> std::experimental::optional<std::string> {
+            if (!output)
+                return {};
+
+            if (output->cacheable)
+                cache().insert(key, output->text);
+
+            return std::move(output->text);
+        });
 }
 }
@@ -0,0 +1,66 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#include "run_cpp_jobs.h"
+
+namespace ohmyarch {
+run_cpp_jobs::ticket run_cpp_jobs::start(std::int64_t chat_id,
+                                         std::int32_t message_id) {
+    const message_key key(chat_id, message_id);
+
+    std::lock_guard<std::mutex> guard(mutex_);
+
+    auto iterator = entries_.find(key);
+    if (iterator == entries_.end()) {
+        if (entries_.size() >= capacity_ && !order_.empty()) {
+            entries_.erase(order_.front());
+            order_.pop_front();
+        }
+
+        iterator = entries_.emplace(key, entry()).first;
+        order_.push_back(key);
+    } else {
+        iterator->second.source.cancel();
+        iterator->second.source = pplx::cancellation_token_source();
+    }
+
+    auto &entry = iterator->second;
+
+    return {chat_id, message_id, ++entry.generation, entry.source.get_token()};
+}
+
+bool run_cpp_jobs::current(const ticket &ticket) const {
+    std::lock_guard<std::mutex> guard(mutex_);
+
+    const auto iterator =
+        entries_.find(message_key(ticket.chat_id, ticket.message_id));
+
+    // An evicted message can't have a newer version.
+    return iterator == entries_.end() ||
+           iterator->second.generation == ticket.generation;
+}
+
+std::experimental::optional<std::int32_t>
+run_cpp_jobs::reply(const ticket &ticket) const {
+    std::lock_guard<std::mutex> guard(mutex_);
+
+    const auto iterator =
+        entries_.find(message_key(ticket.chat_id, ticket.message_id));
+    if (iterator == entries_.end())
+        return {};
+
+    return iterator->second.reply_id;
+}
+
+void run_cpp_jobs::set_reply(const ticket &ticket, std::int32_t reply_id) {
+    std::lock_guard<std::mutex> guard(mutex_);
+
+    const auto iterator =
+        entries_.find(message_key(ticket.chat_id, ticket.message_id));
+    if (iterator != entries_.end())
+        iterator->second.reply_id = reply_id;
+}
+}
@@ -0,0 +1,538 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#include "sandbox.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/mount.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+
+namespace ohmyarch {
+#if defined(__x86_64__)
+static constexpr std::uint32_t audit_arch = AUDIT_ARCH_X86_64;
+#elif defined(__aarch64__)
+static constexpr std::uint32_t audit_arch = AUDIT_ARCH_AARCH64;
+#else
+static constexpr std::uint32_t audit_arch = 0;
+#endif
+
+static const int denied_syscalls[] = {
+    SYS_ptrace, SYS_process_vm_readv, SYS_process_vm_writev, SYS_socket,
+    SYS_mount, SYS_umount2, SYS_pivot_root, SYS_chroot, SYS_unshare, SYS_setns,
+    SYS_setsid, SYS_setpgid, SYS_kexec_load, SYS_reboot, SYS_init_module,
+    SYS_finit_module, SYS_delete_module, SYS_bpf, SYS_perf_event_open,
+    SYS_keyctl, SYS_add_key, SYS_request_key, SYS_personality, SYS_userfaultfd,
+    SYS_open_by_handle_at, SYS_swapon, SYS_swapoff, SYS_acct};
+
+static constexpr std::uint32_t namespace_flags =
+    CLONE_NEWNS | CLONE_NEWCGROUP | CLONE_NEWUTS | CLONE_NEWIPC |
+    CLONE_NEWUSER | CLONE_NEWPID | CLONE_NEWNET;
+
+static sock_filter deny(int error) {
+    return BPF_STMT(BPF_RET | BPF_K,
+                    SECCOMP_RET_ERRNO | (static_cast<std::uint32_t>(error) &
+                                         SECCOMP_RET_DATA));
+}
+
+// Denied syscalls fail with EPERM, and so does clone() asking for new
+// namespaces. clone3() fails with ENOSYS, which makes glibc fall back to
+// clone(), because a filter can't look into its arguments. A syscall made
+// through another ABI than the native one (int 0x80 or x32 on x86-64) kills
+// the process, since the numbers above would not match it.
+static bool install_seccomp_filter() {
+    std::vector<sock_filter> filter{
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(seccomp_data, arch)),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, audit_arch, 1, 0),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_KILL),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(seccomp_data, nr))};
+
+#if defined(__x86_64__)
+    filter.push_back(BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 0x40000000, 0, 1));
+    filter.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_KILL));
+#endif
+
+    for (const int syscall : denied_syscalls) {
+        filter.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                                  static_cast<std::uint32_t>(syscall), 0, 1));
+        filter.push_back(deny(EPERM));
+    }
+
+#ifdef SYS_clone3
+    filter.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_clone3, 0, 1));
+    filter.push_back(deny(ENOSYS));
+#endif
+
+    // The flags are the first argument of clone() on both architectures;
+    // the low half of it is enough for them.
+    filter.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_clone, 0, 3));
+    filter.push_back(
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(seccomp_data, args)));
+    filter.push_back(
+        BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, namespace_flags, 0, 1));
+    filter.push_back(deny(EPERM));
+
+    filter.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW));
+
+    const sock_fprog program{static_cast<unsigned short>(filter.size()),
+                             filter.data()};
+
+    return prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == 0 &&
+           prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &program) == 0;
+}
+
+static bool write_file(const char *path, const char *content) {
+    const int fd = ::open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    const std::size_t size = std::strlen(content);
+    const bool written = ::write(fd, content, size) ==
+                         static_cast<ssize_t>(size);
+    ::close(fd);
+
+    return written;
+}
+
+// Unprivileged processes may only map their own IDs in a user namespace,
+// and can't create files in it until they have.
+static bool map_ids(uid_t uid, gid_t gid) {
+    char map[64];
+
+    if (!write_file("/proc/self/setgroups", "deny"))
+        return false;
+
+    std::snprintf(map, sizeof(map), "%u %u 1", uid, uid);
+    if (!write_file("/proc/self/uid_map", map))
+        return false;
+
+    std::snprintf(map, sizeof(map), "%u %u 1", gid, gid);
+
+    return write_file("/proc/self/gid_map", map);
+}
+
+static bool make_directories(const std::string &path) {
+    for (std::size_t slash = path.find('/', 1);;
+         slash = path.find('/', slash + 1)) {
+        if (::mkdir(path.substr(0, slash).c_str(), 0755) != 0 &&
+            errno != EEXIST)
+            return false;
+
+        if (slash == std::string::npos)
+            return true;
+    }
+}
+
+// Makes an empty file or directory under root for path to be bound on.
+static bool make_mount_point(const std::string &path, bool directory) {
+    if (directory)
+        return make_directories(path);
+
+    if (!make_directories(path.substr(0, path.rfind('/'))))
+        return false;
+
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+    ::close(fd);
+
+    return true;
+}
+
+// Shows path at the same place under root, read-only; a symbolic link is
+// copied instead, and a path that doesn't exist is left out. Flags such as
+// nosuid of the mount path is on are locked in a user namespace, so the
+// remount has to keep them.
+static bool bind_read_only(const std::string &path, const std::string &root) {
+    struct stat status;
+    if (::lstat(path.c_str(), &status) != 0)
+        return errno == ENOENT;
+
+    const std::string target = root + path;
+
+    if (S_ISLNK(status.st_mode)) {
+        char link[PATH_MAX];
+        const ssize_t size = ::readlink(path.c_str(), link, sizeof(link) - 1);
+        if (size < 0 ||
+            !make_directories(target.substr(0, target.rfind('/'))))
+            return false;
+        link[size] = '\0';
+
+        return ::symlink(link, target.c_str()) == 0;
+    }
+
+    struct statvfs file_system;
+    if (::statvfs(path.c_str(), &file_system) != 0 ||
+        !make_mount_point(target, S_ISDIR(status.st_mode)) ||
+        ::mount(path.c_str(), target.c_str(), nullptr, MS_BIND, nullptr) != 0)
+        return false;
+
+    unsigned long flags = MS_REMOUNT | MS_BIND | MS_RDONLY | MS_NOSUID |
+                          MS_NODEV;
+    if (file_system.f_flag & ST_NOEXEC)
+        flags |= MS_NOEXEC;
+    if (file_system.f_flag & ST_NOATIME)
+        flags |= MS_NOATIME;
+    if (file_system.f_flag & ST_NODIRATIME)
+        flags |= MS_NODIRATIME;
+    if (file_system.f_flag & ST_RELATIME)
+        flags |= MS_RELATIME;
+
+    return ::mount(nullptr, target.c_str(), nullptr, flags, nullptr) == 0;
+}
+
+static const char *const devices[] = {"/dev/null", "/dev/random",
+                                      "/dev/urandom", "/dev/zero"};
+
+// Replaces the root with a read-only tmpfs that only holds the read_only
+// paths, a few devices, an empty /tmp and the working directory, which
+// stays at its path and writable. The tmpfs is mounted over the working
+// directory, whose own contents are still reached through working_fd. Returns
+// what failed, or nullptr.
+static const char *build_jail(const std::string &directory, int working_fd,
+                              const std::vector<std::string> &read_only,
+                              const sandbox_limits &limits) {
+    const std::string &root = directory;
+
+    if (::mount(nullptr, "/", nullptr, MS_REC | MS_PRIVATE, nullptr) != 0)
+        return "make the mounts private";
+
+    if (::mount("tmpfs", root.c_str(), "tmpfs", MS_NOSUID | MS_NODEV,
+                "size=1m,mode=0755") != 0)
+        return "mount the root";
+
+    // First, since the other paths may be under it.
+    const std::string tmp = root + "/tmp";
+    const std::string tmp_options =
+        "size=" + std::to_string(limits.file_bytes) + ",mode=1777";
+    if (!make_directories(tmp) ||
+        ::mount("tmpfs", tmp.c_str(), "tmpfs", MS_NOSUID | MS_NODEV,
+                tmp_options.c_str()) != 0)
+        return "/tmp";
+
+    for (const auto &path : read_only)
+        if (!bind_read_only(path, root))
+            return path.c_str();
+
+    for (const char *device : devices) {
+        const std::string target = root + device;
+
+        if (::access(device, F_OK) != 0)
+            continue;
+
+        if (!make_mount_point(target, false) ||
+            ::mount(device, target.c_str(), nullptr, MS_BIND, nullptr) != 0)
+            return device;
+    }
+
+    const std::string working = root + directory;
+    const std::string source = "/proc/self/fd/" + std::to_string(working_fd);
+    if (!make_directories(working) ||
+        ::mount(source.c_str(), working.c_str(), nullptr, MS_BIND, nullptr) !=
+            0 ||
+        ::mount(nullptr, working.c_str(), nullptr,
+                MS_REMOUNT | MS_BIND | MS_NOSUID | MS_NODEV, nullptr) != 0)
+        return directory.c_str();
+
+    if (::mount(nullptr, root.c_str(), nullptr,
+                MS_REMOUNT | MS_RDONLY | MS_NOSUID | MS_NODEV, nullptr) != 0)
+        return "remount the root read-only";
+
+    // The old root ends up under the new one, and is detached from there.
+    if (::chdir(root.c_str()) != 0 ||
+        ::syscall(SYS_pivot_root, ".", ".") != 0 ||
+        ::umount2(".", MNT_DETACH) != 0)
+        return "pivot_root";
+
+    if (::chdir(directory.c_str()) != 0)
+        return "chdir";
+
+    return nullptr;
+}
+
+static void set_limit(int resource, rlim_t value) {
+    const rlimit limit{value, value};
+    ::setrlimit(resource, &limit);
+}
+
+[[noreturn]] static void exec_program(const std::vector<char *> &argv,
+                                      const sandbox_limits &limits) {
+    set_limit(RLIMIT_CPU, limits.cpu_seconds);
+    set_limit(RLIMIT_AS, limits.memory_bytes);
+    set_limit(RLIMIT_FSIZE, limits.file_bytes);
+    set_limit(RLIMIT_CORE, 0);
+    set_limit(RLIMIT_NOFILE, 64);
+    set_limit(RLIMIT_NPROC, limits.processes);
+
+    if (audit_arch != 0 && !install_seccomp_filter()) {
+        std::fputs("sandbox: can't install the seccomp filter\n", stderr);
+        ::_exit(127);
+    }
+
+    ::execvp(argv[0], argv.data());
+
+    std::fprintf(stderr, "sandbox: %s: %s\n", argv[0], std::strerror(errno));
+    ::_exit(127);
+}
+
+// The report descriptor of the init process.
+static constexpr int report_fd = STDERR_FILENO + 1;
+
+// Runs as pid 1 of the new PID namespace. It builds the jail, forks the
+// program and waits for it, reaping whatever else ends up there, then
+// reports the program's status. The kernel kills what is left in the
+// namespace once it exits, and processes in the namespace can't signal it.
+[[noreturn]] static void run_init(const std::vector<char *> &argv,
+                                  const std::string &directory,
+                                  const std::vector<std::string> &read_only,
+                                  const sandbox_limits &limits, int output,
+                                  int report, uid_t uid, gid_t gid) {
+    ::setpgid(0, 0);
+
+    // The worker ignores SIGINT, and ignored signals survive exec.
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGPIPE, SIG_DFL);
+
+    const int input = ::open("/dev/null", O_RDONLY);
+    if (input < 0 || ::dup2(input, STDIN_FILENO) < 0 ||
+        ::dup2(output, STDOUT_FILENO) < 0 ||
+        ::dup2(output, STDERR_FILENO) < 0 || ::dup2(report, report_fd) < 0 ||
+        ::fcntl(report_fd, F_SETFD, FD_CLOEXEC) != 0)
+        ::_exit(127);
+
+    const long max_fd = std::min(::sysconf(_SC_OPEN_MAX), 65536L);
+    for (long fd = report_fd + 1; fd < max_fd; ++fd)
+        ::close(static_cast<int>(fd));
+
+    const int working_fd =
+        ::open(directory.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+    const char *failed = nullptr;
+    if (!map_ids(uid, gid))
+        failed = "map the user IDs";
+    else if (working_fd < 0)
+        failed = directory.c_str();
+    else
+        failed = build_jail(directory, working_fd, read_only, limits);
+
+    if (failed != nullptr) {
+        std::fprintf(stderr, "sandbox: can't set up the jail: %s: %s\n",
+                     failed, std::strerror(errno));
+        ::_exit(127);
+    }
+
+    ::close(working_fd);
+
+    const pid_t pid = ::fork();
+    if (pid < 0) {
+        std::fprintf(stderr, "sandbox: fork: %s\n", std::strerror(errno));
+        ::_exit(127);
+    }
+
+    if (pid == 0)
+        exec_program(argv, limits);
+
+    // Leaves the pipe to the program, so it ends when the program's
+    // processes are gone.
+    ::close(STDOUT_FILENO);
+    ::close(STDERR_FILENO);
+
+    int status = 0;
+    for (;;) {
+        int reaped_status;
+        const pid_t reaped = ::waitpid(-1, &reaped_status, 0);
+        if (reaped < 0 && errno == EINTR)
+            continue;
+        if (reaped < 0)
+            ::_exit(127);
+
+        if (reaped == pid) {
+            status = reaped_status;
+            break;
+        }
+    }
+
+    if (::write(report_fd, &status, sizeof(status)) !=
+        static_cast<ssize_t>(sizeof(status)))
+        ::_exit(127);
+
+    ::_exit(0);
+}
+
+static constexpr std::chrono::milliseconds poll_interval(10);
+
+sandbox_result run_sandboxed(const std::vector<std::string> &argv,
+                             const std::string &directory,
+                             const std::vector<std::string> &read_only,
+                             const sandbox_limits &limits, int cancel) {
+    std::vector<char *> arguments;
+    for (const auto &argument : argv)
+        arguments.push_back(const_cast<char *>(argument.c_str()));
+    arguments.push_back(nullptr);
+
+    // The working directory keeps its path in the jail.
+    char resolved[PATH_MAX];
+    if (::realpath(directory.c_str(), resolved) == nullptr)
+        throw std::system_error(errno, std::generic_category(),
+                                "realpath " + directory);
+
+    int channel[2];
+    if (::pipe2(channel, O_CLOEXEC) != 0)
+        throw std::system_error(errno, std::generic_category(), "pipe2");
+
+    int report[2];
+    if (::pipe2(report, O_CLOEXEC) != 0) {
+        const int error = errno;
+        ::close(channel[0]);
+        ::close(channel[1]);
+
+        throw std::system_error(error, std::generic_category(), "pipe2");
+    }
+
+    const uid_t uid = ::getuid();
+    const gid_t gid = ::getgid();
+
+    // Like fork(), into new namespaces. Without user namespaces this fails,
+    // and nothing runs unconfined.
+    const pid_t pid = static_cast<pid_t>(
+        ::syscall(SYS_clone, namespace_flags | SIGCHLD, nullptr, nullptr,
+                  nullptr, nullptr));
+    if (pid < 0) {
+        const int error = errno;
+        ::close(channel[0]);
+        ::close(channel[1]);
+        ::close(report[0]);
+        ::close(report[1]);
+
+        throw std::system_error(error, std::generic_category(), "clone");
+    }
+
+    if (pid == 0)
+        run_init(arguments, resolved, read_only, limits, channel[1],
+                 report[1], uid, gid);
+
+    ::close(channel[1]);
+    ::close(report[1]);
+
+    // The child may not have called setpgid() yet.
+    ::setpgid(pid, pid);
+
+    using clock = std::chrono::steady_clock;
+    const auto deadline = clock::now() + limits.wall_time;
+
+    sandbox_result result{{}, 0, false, false, false};
+    bool reaped = false;
+
+    // Reads until every process of the jail has closed the pipe or the
+    // init process has exited; a program that leaves a process behind
+    // holding the pipe shouldn't use up the wall time. Once it has exited,
+    // only what is already in the pipe is read.
+    char buffer[4096];
+    for (;;) {
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - clock::now());
+        if (left.count() <= 0 && !reaped) {
+            result.timed_out = true;
+            break;
+        }
+
+        const int timeout =
+            reaped ? 0 : static_cast<int>(std::min<std::int64_t>(
+                             left.count(), poll_interval.count()));
+
+        pollfd readable[2] = {{channel[0], POLLIN, 0}, {cancel, POLLIN, 0}};
+        const int ready = ::poll(readable, cancel >= 0 ? 2 : 1, timeout);
+        if (ready < 0 && errno != EINTR)
+            break;
+
+        if (ready > 0 && cancel >= 0 && readable[1].revents != 0) {
+            result.canceled = true;
+            break;
+        }
+
+        if (ready == 0) {
+            if (reaped)
+                break;
+
+            reaped = ::waitpid(pid, &result.status, WNOHANG) == pid;
+
+            continue;
+        }
+
+        if (ready < 0)
+            continue;
+
+        const ssize_t size = ::read(channel[0], buffer, sizeof(buffer));
+        if (size < 0 && errno == EINTR)
+            continue;
+        if (size <= 0)
+            break;
+
+        const std::size_t room = limits.output_bytes - result.output.size();
+        result.output.append(buffer,
+                             std::min(static_cast<std::size_t>(size), room));
+        if (static_cast<std::size_t>(size) > room) {
+            result.truncated = true;
+            break;
+        }
+    }
+
+    ::close(channel[0]);
+
+    // The pipe closes before the init process has reported the program's
+    // status, which it gets the rest of the wall time for.
+    while (!reaped && !result.timed_out && !result.truncated &&
+           !result.canceled) {
+        reaped = ::waitpid(pid, &result.status, WNOHANG) == pid;
+
+        if (reaped)
+            break;
+
+        if (clock::now() >= deadline)
+            result.timed_out = true;
+        else
+            std::this_thread::sleep_for(poll_interval);
+    }
+
+    // Killing the init process kills the whole namespace.
+    ::kill(-pid, SIGKILL);
+
+    if (!reaped)
+        while (::waitpid(pid, &result.status, 0) < 0 && errno == EINTR)
+            ;
+
+    // The init process only reports once the program has exited; until
+    // then, its own status stands.
+    int status;
+    if (WIFEXITED(result.status) && WEXITSTATUS(result.status) == 0 &&
+        ::read(report[0], &status, sizeof(status)) ==
+            static_cast<ssize_t>(sizeof(status)))
+        result.status = status;
+
+    ::close(report[0]);
+
+    return result;
+}
+}
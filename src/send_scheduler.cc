@@ -0,0 +1,266 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#include "send_scheduler.h"
+#include "trace.h"
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+
+namespace ohmyarch {
+static const web::http::status_code too_many_requests = 429;
+
+void send_scheduler::token_bucket::refill(clock::time_point now) {
+    if (now <= updated)
+        return;
+
+    tokens = std::min(
+        burst,
+        tokens + rate * std::chrono::duration<double>(now - updated).count());
+    updated = now;
+}
+
+send_scheduler::clock::time_point
+send_scheduler::token_bucket::ready_at(clock::time_point now) {
+    refill(now);
+
+    clock::time_point ready = now;
+    if (tokens < 1.0)
+        ready += std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double>((1.0 - tokens) / rate));
+
+    return std::max(ready, blocked_until);
+}
+
+send_scheduler::send_scheduler(const limits &limits) : limits_(limits) {
+    thread_ = std::thread(&send_scheduler::run, this);
+}
+
+// Sends still queued are dropped.
+send_scheduler::~send_scheduler() {
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        stopping_ = true;
+    }
+
+    condition_.notify_one();
+    thread_.join();
+}
+
+std::size_t send_scheduler::pending() const {
+    std::lock_guard<std::mutex> guard(mutex_);
+
+    return queue_.size();
+}
+
+pplx::task<web::http::http_response>
+send_scheduler::schedule(std::size_t bot, std::int64_t chat_id,
+                         send_priority priority, sender send) {
+    pplx::task_completion_event<web::http::http_response> done;
+    const chat_key chat(bot, chat_id);
+    const std::uint64_t trace = current_trace();
+
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+
+        const std::uint64_t sequence = sequence_++;
+        queue_.emplace(queue_key(priority, sequence),
+                       item{chat, std::move(send), 0, done, trace,
+                            clock::now()});
+        chat_order_[chat].push_back(sequence);
+    }
+
+    condition_.notify_one();
+
+    return pplx::create_task(done);
+}
+
+// Called with mutex_ held.
+send_scheduler::token_bucket &
+send_scheduler::bot_bucket(std::size_t bot, clock::time_point now) {
+    auto iterator = bots_.find(bot);
+    if (iterator != bots_.end())
+        return iterator->second;
+
+    const double rate = limits_.global_per_second;
+
+    return bots_
+        .emplace(bot, token_bucket{rate, rate, std::max(rate, 1.0), now,
+                                   clock::time_point()})
+        .first->second;
+}
+
+// Called with mutex_ held.
+send_scheduler::token_bucket &
+send_scheduler::chat_bucket(const chat_key &chat, clock::time_point now) {
+    auto iterator = chats_.find(chat);
+    if (iterator != chats_.end())
+        return iterator->second;
+
+    // Full buckets of chats that aren't held back carry no state worth
+    // keeping.
+    if (chats_.size() >= 4096)
+        for (auto it = chats_.begin(); it != chats_.end();) {
+            it->second.refill(now);
+            if (it->second.tokens >= it->second.burst &&
+                it->second.blocked_until <= now)
+                it = chats_.erase(it);
+            else
+                ++it;
+        }
+
+    // Group chats have negative ids.
+    const double rate = chat.second < 0 ? limits_.group_per_second
+                                        : limits_.private_per_second;
+    const double burst = std::max(rate, 1.0);
+
+    return chats_
+        .emplace(chat, token_bucket{burst, rate, burst, now,
+                                    clock::time_point()})
+        .first->second;
+}
+
+void send_scheduler::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (!stopping_) {
+        if (queue_.empty()) {
+            condition_.wait(lock);
+
+            continue;
+        }
+
+        const auto now = clock::now();
+
+        auto chosen = queue_.end();
+        auto wake = clock::time_point::max();
+
+        for (auto iterator = queue_.begin(); iterator != queue_.end();
+             ++iterator) {
+            const chat_key &chat = iterator->second.chat;
+            if (chat_order_[chat].front() != iterator->first.second)
+                continue;
+
+            const auto ready =
+                std::max(bot_bucket(chat.first, now).ready_at(now),
+                         chat_bucket(chat, now).ready_at(now));
+            if (ready <= now) {
+                chosen = iterator;
+
+                break;
+            }
+
+            wake = std::min(wake, ready);
+        }
+
+        if (chosen == queue_.end()) {
+            condition_.wait_until(lock, wake);
+
+            continue;
+        }
+
+        const chat_key chat = chosen->second.chat;
+
+        bot_bucket(chat.first, now).tokens -= 1.0;
+        chat_bucket(chat, now).tokens -= 1.0;
+
+        const queue_key key = chosen->first;
+        item next = std::move(chosen->second);
+        queue_.erase(chosen);
+
+        lock.unlock();
+        dispatch(key, std::move(next));
+        lock.lock();
+    }
+}
+
+void send_scheduler::dispatch(queue_key key, item next) {
+    record_span(next.trace, "send_wait", next.queued, clock::now(),
+                next.chat.second);
+
+    pplx::task<web::http::http_response> sent;
+
+    try {
+        sent = next.send();
+    } catch (...) {
+        release(next.chat);
+        next.done.set_exception(std::current_exception());
+
+        return;
+    }
+
+    auto pending = std::make_shared<item>(std::move(next));
+
+    sent.then([this, key, pending](pplx::task<web::http::http_response> task) {
+        web::http::http_response response;
+
+        try {
+            response = task.get();
+        } catch (...) {
+            release(pending->chat);
+            pending->done.set_exception(std::current_exception());
+
+            return;
+        }
+
+        if (response.status_code() != too_many_requests ||
+            pending->attempts >= limits_.max_retries) {
+            release(pending->chat);
+            pending->done.set(response);
+
+            return;
+        }
+
+        response.extract_string().then(
+            [this, key, pending](pplx::task<utility::string_t> body) {
+                std::int64_t retry_after = 1;
+
+                try {
+                    const auto json = nlohmann::json::parse(body.get());
+                    retry_after = json.at("parameters").at("retry_after");
+                } catch (const std::exception &) {
+                }
+
+                spdlog::get("logger")->warn(
+                    "⚠️ flood limit hit for 💬<{}>, retrying in {} s",
+                    pending->chat.second, retry_after);
+
+                {
+                    std::lock_guard<std::mutex> guard(mutex_);
+
+                    const auto now = clock::now();
+
+                    auto &bucket = chat_bucket(pending->chat, now);
+                    bucket.blocked_until =
+                        std::max(bucket.blocked_until,
+                                 now + std::chrono::seconds(retry_after));
+
+                    ++pending->attempts;
+                    pending->queued = now;
+
+                    // Still first in chat_order_, so it goes out before the
+                    // chat's later sends.
+                    queue_.emplace(key, std::move(*pending));
+                }
+
+                condition_.notify_one();
+            });
+    });
+}
+
+// Lets the next send of chat go out once one is answered.
+void send_scheduler::release(const chat_key &chat) {
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+
+        auto &order = chat_order_[chat];
+        order.pop_front();
+        if (order.empty())
+            chat_order_.erase(chat);
+    }
+
+    condition_.notify_one();
+}
+}
@@ -0,0 +1,346 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#include "shard.h"
+#include "socket_frames.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <spdlog/spdlog.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace ohmyarch {
+// A command frame is sequence, bot, command, chat_id, message_id and trace_id,
+// then the code; a finished frame is just the sequence.
+static const std::size_t command_header_size = 8 + 1 + 1 + 8 + 4 + 8;
+
+// Unfinished commands kept for a worker that can't keep up or keeps dying;
+// commands beyond that are dropped.
+static const std::size_t max_unfinished = 65536;
+
+template <typename T> static void put(char *&out, const T &value) {
+    std::memcpy(out, &value, sizeof(value));
+    out += sizeof(value);
+}
+
+template <typename T> static void get(const char *&in, T &value) {
+    std::memcpy(&value, in, sizeof(value));
+    in += sizeof(value);
+}
+
+static std::string encode(const shard_command &command) {
+    std::string payload(command_header_size + command.code.size(), '\0');
+
+    char *out = &payload[0];
+    put(out, command.sequence);
+    put(out, command.bot);
+    put(out, static_cast<std::uint8_t>(command.command));
+    put(out, command.chat_id);
+    put(out, command.message_id);
+    put(out, command.trace_id);
+    std::memcpy(out, command.code.data(), command.code.size());
+
+    return payload;
+}
+
+static bool decode(const std::string &payload, shard_command &command) {
+    if (payload.size() < command_header_size)
+        return false;
+
+    std::uint8_t type;
+
+    const char *in = payload.data();
+    get(in, command.sequence);
+    get(in, command.bot);
+    get(in, type);
+    get(in, command.chat_id);
+    get(in, command.message_id);
+    get(in, command.trace_id);
+    command.code.assign(in, payload.data() + payload.size());
+
+    if (type > static_cast<std::uint8_t>(bot_command::about))
+        return false;
+    command.command = static_cast<bot_command>(type);
+
+    return true;
+}
+
+std::size_t shard_of(std::size_t bot, std::int64_t chat_id,
+                     std::size_t workers) {
+    // Chat ids take up less than 53 bits; the bot goes in the top byte.
+    std::uint64_t key = static_cast<std::uint64_t>(chat_id) ^
+                        (static_cast<std::uint64_t>(bot) << 56);
+
+    std::int64_t bucket = -1;
+    std::int64_t next = 0;
+    while (next < static_cast<std::int64_t>(workers)) {
+        bucket = next;
+        key = key * 2862933555777941757ull + 1;
+        next = static_cast<std::int64_t>(
+            (bucket + 1) *
+            (static_cast<double>(1ll << 31) /
+             static_cast<double>((key >> 33) + 1)));
+    }
+
+    return static_cast<std::size_t>(bucket);
+}
+
+shard_router::shard_router(const std::string &program,
+                           const std::vector<std::string> &arguments,
+                           std::size_t workers)
+    : program_(program), arguments_(arguments) {
+    for (std::size_t index = 0; index < std::max<std::size_t>(workers, 1);
+         ++index) {
+        workers_.emplace_back(new worker);
+        workers_.back()->index = index;
+
+        std::lock_guard<std::mutex> guard(workers_.back()->mutex);
+        spawn(*workers_.back());
+    }
+
+    for (auto &worker : workers_) {
+        worker->reader =
+            std::thread(&shard_router::read, this, std::ref(*worker));
+        worker->writer =
+            std::thread(&shard_router::write, this, std::ref(*worker));
+    }
+}
+
+shard_router::~shard_router() {
+    stopping_ = true;
+
+    for (auto &worker : workers_) {
+        std::lock_guard<std::mutex> guard(worker->mutex);
+
+        if (worker->socket != -1)
+            ::shutdown(worker->socket, SHUT_WR);
+
+        worker->changed.notify_all();
+    }
+
+    std::size_t lost = 0;
+
+    for (auto &worker : workers_) {
+        worker->writer.join();
+        worker->reader.join();
+        lost += worker->unfinished.size();
+    }
+
+    if (lost != 0)
+        spdlog::get("logger")->warn(
+            "⚠️ shard workers stopped with {} commands unfinished", lost);
+}
+
+void shard_router::route(shard_command command) {
+    auto &worker =
+        *workers_[shard_of(command.bot, command.chat_id, workers_.size())];
+
+    std::lock_guard<std::mutex> guard(worker.mutex);
+
+    if (worker.unfinished.size() >= max_unfinished) {
+        spdlog::get("logger")->warn(
+            "⚠️ command dropped for 💬<{}>: shard worker {} is behind",
+            command.chat_id, worker.index);
+
+        return;
+    }
+
+    command.sequence = worker.next_sequence++;
+
+    // A worker that is gone gets it once it has been restarted.
+    worker.unfinished.emplace(command.sequence, encode(command));
+    worker.changed.notify_all();
+}
+
+std::size_t shard_router::pending() const {
+    std::size_t pending = 0;
+
+    for (const auto &worker : workers_) {
+        std::lock_guard<std::mutex> guard(worker->mutex);
+        pending += worker->unfinished.size();
+    }
+
+    return pending;
+}
+
+void shard_router::spawn(worker &worker) {
+    int sockets[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) != 0)
+        throw std::system_error(errno, std::generic_category(), "socketpair");
+
+    std::vector<std::string> arguments{program_};
+    arguments.insert(arguments.end(), arguments_.begin(), arguments_.end());
+    arguments.insert(arguments.end(),
+                     {"--shard", std::to_string(worker.index),
+                      "--shard-socket", std::to_string(sockets[1])});
+
+    std::vector<char *> argv;
+    for (auto &argument : arguments)
+        argv.push_back(&argument[0]);
+    argv.push_back(nullptr);
+
+    const pid_t pid = ::fork();
+    if (pid < 0) {
+        const int error = errno;
+        ::close(sockets[0]);
+        ::close(sockets[1]);
+
+        throw std::system_error(error, std::generic_category(), "fork");
+    }
+
+    // Other threads may hold locks, so the child only makes async-signal-safe
+    // calls before exec.
+    if (pid == 0) {
+        ::fcntl(sockets[1], F_SETFD, 0);
+        ::execv(program_.c_str(), argv.data());
+        ::_exit(127);
+    }
+
+    ::close(sockets[1]);
+
+    worker.pid = pid;
+    worker.socket = sockets[0];
+}
+
+// Takes the finished frames of one worker, and restarts it when its socket
+// closes while the router is running.
+void shard_router::read(worker &worker) {
+    for (;;) {
+        int socket;
+        {
+            std::lock_guard<std::mutex> guard(worker.mutex);
+            socket = worker.socket;
+        }
+
+        std::string payload;
+        while (receive_frame(socket, payload)) {
+            std::uint64_t sequence;
+            if (payload.size() != sizeof(sequence))
+                continue;
+            std::memcpy(&sequence, payload.data(), sizeof(sequence));
+
+            std::lock_guard<std::mutex> guard(worker.mutex);
+            worker.unfinished.erase(sequence);
+        }
+
+        pid_t pid;
+        {
+            std::unique_lock<std::mutex> lock(worker.mutex);
+            worker.socket = -1;
+
+            // The writer may still be sending on it.
+            worker.changed.wait(lock, [&worker] { return !worker.sending; });
+            ::close(socket);
+
+            pid = worker.pid;
+        }
+
+        int status = 0;
+        ::waitpid(pid, &status, 0);
+
+        if (stopping_)
+            return;
+
+        spdlog::get("logger")->error(
+            "❌ shard worker {} exited with status {}, restarting",
+            worker.index, status);
+
+        for (;;) {
+            // Keeps a worker that dies on startup from spinning.
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+
+            // Checked under the lock, so the destructor either sees the new
+            // socket or this sees it stopping.
+            std::lock_guard<std::mutex> guard(worker.mutex);
+            if (stopping_)
+                return;
+
+            try {
+                spawn(worker);
+            } catch (const std::exception &error) {
+                spdlog::get("logger")->error("❌ shard worker {}: {}",
+                                             worker.index, error.what());
+
+                continue;
+            }
+
+            // The writer sends them all again, in order, before any new one.
+            worker.next_unsent = 0;
+            worker.changed.notify_all();
+
+            spdlog::get("logger")->info(
+                "ℹ️ shard worker {} restarted with {} unfinished commands",
+                worker.index, worker.unfinished.size());
+
+            break;
+        }
+    }
+}
+
+// Sends the commands of one worker in sequence order, without holding the
+// mutex, so route() doesn't wait for a worker that is slow to read. A failed
+// send is left to the reader, which sees the socket close.
+void shard_router::write(worker &worker) {
+    std::unique_lock<std::mutex> lock(worker.mutex);
+
+    for (;;) {
+        std::map<std::uint64_t, std::string>::const_iterator next;
+
+        worker.changed.wait(lock, [this, &worker, &next] {
+            if (stopping_)
+                return true;
+            if (worker.socket == -1)
+                return false;
+
+            next = worker.unfinished.lower_bound(worker.next_unsent);
+
+            return next != worker.unfinished.end();
+        });
+
+        if (stopping_)
+            return;
+
+        const int socket = worker.socket;
+        const std::string payload = next->second;
+        worker.next_unsent = next->first + 1;
+        worker.sending = true;
+
+        lock.unlock();
+        send_frame(socket, payload);
+        lock.lock();
+
+        worker.sending = false;
+        worker.changed.notify_all();
+    }
+}
+
+shard_inbox::~shard_inbox() { ::close(socket_); }
+
+bool shard_inbox::receive(shard_command &command) {
+    std::string payload;
+
+    while (receive_frame(socket_, payload)) {
+        if (decode(payload, command))
+            return true;
+
+        spdlog::get("logger")->error("❌ shard_inbox: malformed command");
+    }
+
+    return false;
+}
+
+void shard_inbox::finish(std::uint64_t sequence) {
+    const std::string payload(reinterpret_cast<const char *>(&sequence),
+                              sizeof(sequence));
+
+    std::lock_guard<std::mutex> guard(send_mutex_);
+    send_frame(socket_, payload);
+}
+}
@@ -0,0 +1,116 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#include "socket_frames.h"
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+
+namespace ohmyarch {
+bool send_all(int socket, const void *data, std::size_t size) {
+    const char *bytes = static_cast<const char *>(data);
+
+    while (size != 0) {
+        const ssize_t sent = ::send(socket, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+
+        bytes += sent;
+        size -= static_cast<std::size_t>(sent);
+    }
+
+    return true;
+}
+
+bool receive_all(int socket, void *data, std::size_t size) {
+    char *bytes = static_cast<char *>(data);
+
+    while (size != 0) {
+        const ssize_t received = ::recv(socket, bytes, size, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+
+        bytes += received;
+        size -= static_cast<std::size_t>(received);
+    }
+
+    return true;
+}
+
+bool send_frame(int socket, const std::string &payload) {
+    const std::uint32_t size = static_cast<std::uint32_t>(payload.size());
+
+    return send_all(socket, &size, sizeof(size)) &&
+           send_all(socket, payload.data(), payload.size());
+}
+
+bool receive_frame(int socket, std::string &payload) {
+    std::uint32_t size;
+    if (!receive_all(socket, &size, sizeof(size)))
+        return false;
+
+    payload.resize(size);
+
+    return receive_all(socket, &payload[0], size);
+}
+
+bool send_descriptor(int socket, std::int32_t value, int descriptor) {
+    iovec data{&value, sizeof(value)};
+    char control[CMSG_SPACE(sizeof(int))] = {};
+
+    msghdr message{};
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+
+    if (descriptor >= 0) {
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        cmsghdr *header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(header), &descriptor, sizeof(int));
+    }
+
+    for (;;) {
+        const ssize_t sent = ::sendmsg(socket, &message, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+
+        return sent == static_cast<ssize_t>(sizeof(value));
+    }
+}
+
+bool receive_descriptor(int socket, std::int32_t &value, int &descriptor) {
+    iovec data{&value, sizeof(value)};
+    char control[CMSG_SPACE(sizeof(int))] = {};
+
+    msghdr message{};
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t received;
+    do
+        received = ::recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+    while (received < 0 && errno == EINTR);
+
+    descriptor = -1;
+
+    const cmsghdr *header = CMSG_FIRSTHDR(&message);
+    if (received > 0 && header != nullptr &&
+        header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+        std::memcpy(&descriptor, CMSG_DATA(header), sizeof(int));
+
+    return received == static_cast<ssize_t>(sizeof(value));
+}
+}
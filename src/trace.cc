@@ -0,0 +1,275 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#include "config.h"
+#include "trace.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <random>
+#include <spdlog/spdlog.h>
+#include <system_error>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace ohmyarch {
+namespace {
+struct span {
+    std::uint64_t trace;
+    const char *name;
+    trace_clock::time_point start;
+    trace_clock::time_point end;
+    std::int64_t chat_id;
+    std::uint32_t thread;
+};
+
+struct span_ring {
+    span_ring(std::size_t capacity, std::uint32_t thread)
+        : spans(capacity), thread(thread) {}
+
+    // Only contended while an export copies the spans.
+    std::mutex mutex;
+    std::vector<span> spans;
+    std::size_t next = 0;
+    std::size_t size = 0;
+    const std::uint32_t thread;
+};
+
+// The rings of threads that have exited stay, with their spans.
+std::mutex rings_mutex;
+std::vector<std::shared_ptr<span_ring>> rings;
+
+thread_local std::uint64_t thread_trace = 0;
+
+std::atomic<bool> export_requested(false);
+
+span_ring &thread_ring() {
+    thread_local const std::shared_ptr<span_ring> ring = [] {
+        std::lock_guard<std::mutex> guard(rings_mutex);
+
+        rings.push_back(std::make_shared<span_ring>(
+            std::max<std::size_t>(trace_buffer_spans, 1),
+            static_cast<std::uint32_t>(rings.size())));
+
+        return rings.back();
+    }();
+
+    return *ring;
+}
+
+std::vector<span> collect_spans() {
+    std::vector<std::shared_ptr<span_ring>> all;
+    {
+        std::lock_guard<std::mutex> guard(rings_mutex);
+        all = rings;
+    }
+
+    std::vector<span> spans;
+
+    for (const auto &ring : all) {
+        std::lock_guard<std::mutex> guard(ring->mutex);
+
+        const std::size_t capacity = ring->spans.size();
+        for (std::size_t index = 0; index < ring->size; ++index)
+            spans.push_back(
+                ring->spans[(ring->next + capacity - ring->size + index) %
+                            capacity]);
+    }
+
+    std::sort(spans.begin(), spans.end(), [](const span &a, const span &b) {
+        return a.start < b.start;
+    });
+
+    return spans;
+}
+
+std::string hex(std::uint64_t value, int digits = 16) {
+    char buffer[33];
+    std::snprintf(buffer, sizeof(buffer), "%0*llx", digits,
+                  static_cast<unsigned long long>(value));
+
+    return buffer;
+}
+
+double microseconds(trace_clock::duration duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+// One row per trace, named after it, so a command reads left to right.
+nlohmann::json chrome_trace(const std::vector<span> &spans) {
+    const auto pid = static_cast<std::int64_t>(::getpid());
+
+    nlohmann::json events = nlohmann::json::array();
+    std::unordered_map<std::uint64_t, std::size_t> rows;
+
+    for (const auto &span : spans) {
+        const auto inserted = rows.emplace(span.trace, rows.size() + 1);
+        const std::size_t row = inserted.first->second;
+
+        if (inserted.second)
+            events.push_back(
+                {{"name", "thread_name"},
+                 {"ph", "M"},
+                 {"pid", pid},
+                 {"tid", row},
+                 {"args", {{"name", "trace " + hex(span.trace)}}}});
+
+        events.push_back(
+            {{"name", span.name},
+             {"cat", "ohmyarch"},
+             {"ph", "X"},
+             {"ts", microseconds(span.start.time_since_epoch())},
+             {"dur", microseconds(span.end - span.start)},
+             {"pid", pid},
+             {"tid", row},
+             {"args",
+              {{"trace", hex(span.trace)},
+               {"chat_id", span.chat_id},
+               {"thread", span.thread}}}});
+    }
+
+    return {{"traceEvents", std::move(events)}, {"displayTimeUnit", "ms"}};
+}
+
+nlohmann::json otlp_trace(const std::vector<span> &spans) {
+    // Spans are timed on the steady clock; OTLP wants Unix time.
+    const auto offset = std::chrono::system_clock::now().time_since_epoch() -
+                        trace_clock::now().time_since_epoch();
+    const auto unix_nanoseconds = [offset](trace_clock::time_point time) {
+        return std::to_string(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                time.time_since_epoch() + offset)
+                .count());
+    };
+
+    std::uint64_t span_id = std::random_device()();
+    span_id = span_id << 32 | std::random_device()();
+
+    nlohmann::json otlp_spans = nlohmann::json::array();
+
+    for (const auto &span : spans)
+        otlp_spans.push_back(
+            {{"traceId", hex(span.trace, 32)},
+             {"spanId", hex(++span_id)},
+             {"name", span.name},
+             {"kind", 1},
+             {"startTimeUnixNano", unix_nanoseconds(span.start)},
+             {"endTimeUnixNano", unix_nanoseconds(span.end)},
+             {"attributes",
+              {{{"key", "chat_id"},
+                {"value", {{"intValue", std::to_string(span.chat_id)}}}},
+               {{"key", "thread.id"},
+                {"value", {{"intValue", std::to_string(span.thread)}}}}}}});
+
+    const nlohmann::json resource{
+        {"attributes",
+         {{{"key", "service.name"},
+           {"value", {{"stringValue", "ohmyarch_bot"}}}},
+          {{"key", "process.pid"},
+           {"value", {{"intValue", std::to_string(::getpid())}}}}}}};
+
+    return {{"resourceSpans",
+             {{{"resource", resource},
+               {"scopeSpans",
+                {{{"scope", {{"name", "ohmyarch_bot"}}},
+                  {"spans", std::move(otlp_spans)}}}}}}}};
+}
+}
+
+std::uint64_t start_trace() {
+    if (trace_sample_rate <= 0.0)
+        return 0;
+
+    thread_local std::mt19937_64 engine(std::random_device{}());
+
+    if (trace_sample_rate < 1.0 &&
+        !std::bernoulli_distribution(trace_sample_rate)(engine))
+        return 0;
+
+    std::uint64_t trace;
+    do
+        trace = engine();
+    while (trace == 0);
+
+    return trace;
+}
+
+void record_span(std::uint64_t trace, const char *name,
+                 trace_clock::time_point start, trace_clock::time_point end,
+                 std::int64_t chat_id) {
+    if (trace == 0)
+        return;
+
+    auto &ring = thread_ring();
+
+    std::lock_guard<std::mutex> guard(ring.mutex);
+
+    ring.spans[ring.next] = {trace, name, start, end, chat_id, ring.thread};
+    ring.next = (ring.next + 1) % ring.spans.size();
+    ring.size = std::min(ring.size + 1, ring.spans.size());
+}
+
+std::uint64_t current_trace() { return thread_trace; }
+
+trace_scope::trace_scope(std::uint64_t trace) : previous_(thread_trace) {
+    thread_trace = trace;
+}
+
+trace_scope::~trace_scope() { thread_trace = previous_; }
+
+std::size_t write_traces(const std::string &path, trace_format format) {
+    const auto spans = collect_spans();
+    const std::string temporary = path + ".tmp";
+
+    {
+        std::ofstream file(temporary, std::ios::trunc);
+        file << (format == trace_format::chrome ? chrome_trace(spans)
+                                                 : otlp_trace(spans));
+        if (!file)
+            throw std::runtime_error("can't write " + temporary);
+    }
+
+    if (std::rename(temporary.c_str(), path.c_str()) != 0)
+        throw std::system_error(errno, std::generic_category(),
+                                "rename " + temporary);
+
+    return spans.size();
+}
+
+void request_trace_export() { export_requested = true; }
+
+trace_exporter::trace_exporter(const std::string &path, trace_format format)
+    : path_(path), format_(format),
+      thread_(&trace_exporter::run, this) {}
+
+trace_exporter::~trace_exporter() {
+    stopping_ = true;
+    thread_.join();
+}
+
+// A signal handler can't take locks, so the flag is polled.
+void trace_exporter::run() {
+    while (!stopping_) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+        if (!export_requested.exchange(false))
+            continue;
+
+        try {
+            const std::size_t count = write_traces(path_, format_);
+
+            spdlog::get("logger")->info("ℹ️ {} spans written to {}", count,
+                                        path_);
+        } catch (const std::exception &error) {
+            spdlog::get("logger")->error("❌ write_traces: {}", error.what());
+        }
+    }
+}
+}
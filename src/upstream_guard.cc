@@ -0,0 +1,360 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#include "config.h"
+#include "http_pool.h"
+#include "upstream_guard.h"
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <spdlog/spdlog.h>
+#include <thread>
+#include <vector>
+
+namespace ohmyarch {
+namespace {
+using clock = std::chrono::steady_clock;
+
+const std::uint64_t hedge_min_samples = 100;
+
+std::atomic<std::uint64_t> hedged{0};
+std::atomic<std::uint64_t> rejected{0};
+
+// Runs callbacks at their time, one after another, on a thread of its own.
+// They have to be quick.
+class timer_queue {
+  public:
+    timer_queue() : thread_(&timer_queue::run, this) {}
+
+    ~timer_queue() {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            stopping_ = true;
+        }
+
+        condition_.notify_one();
+        thread_.join();
+    }
+
+    void schedule(clock::time_point time, std::function<void()> callback) {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            timers_.emplace(time, std::move(callback));
+        }
+
+        condition_.notify_one();
+    }
+
+  private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        while (!stopping_) {
+            if (timers_.empty()) {
+                condition_.wait(lock);
+
+                continue;
+            }
+
+            const auto first = timers_.begin();
+            if (first->first > clock::now()) {
+                condition_.wait_until(lock, first->first);
+
+                continue;
+            }
+
+            const auto callback = std::move(first->second);
+            timers_.erase(first);
+
+            lock.unlock();
+            callback();
+            lock.lock();
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::multimap<clock::time_point, std::function<void()>> timers_;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+timer_queue &timers() {
+    static timer_queue timers;
+
+    return timers;
+}
+
+class circuit_breaker {
+  public:
+    // Whether a call may go out.
+    bool allow(clock::time_point now) {
+        std::lock_guard<std::mutex> guard(mutex_);
+
+        switch (state_) {
+        case state::closed:
+            return true;
+        case state::open:
+            if (now < open_until_)
+                return false;
+
+            state_ = state::half_open;
+            probe_sent_ = now;
+
+            return true;
+        case state::half_open:
+            // A probe canceled by its caller never reports back.
+            if (now - probe_sent_ < breaker_limits.cooldown)
+                return false;
+
+            probe_sent_ = now;
+
+            return true;
+        }
+
+        return true;
+    }
+
+    void record(upstream upstream, bool failed, clock::time_point now) {
+        const auto &limits = breaker_limits;
+
+        std::size_t failures = 0;
+        bool opened = false;
+        bool closed = false;
+
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+
+            if (state_ == state::open)
+                return;
+
+            if (state_ == state::half_open) {
+                if (failed) {
+                    state_ = state::open;
+                    open_until_ = now + limits.cooldown;
+                } else {
+                    state_ = state::closed;
+                    closed = true;
+                }
+            } else {
+                if (outcomes_.size() != limits.window)
+                    outcomes_.assign(limits.window, false);
+
+                if (size_ == outcomes_.size())
+                    failures_ -= outcomes_[next_];
+                else
+                    ++size_;
+
+                outcomes_[next_] = failed;
+                failures_ += failed;
+                next_ = (next_ + 1) % outcomes_.size();
+
+                if (size_ == outcomes_.size() &&
+                    static_cast<double>(failures_) >=
+                        limits.failure_rate * static_cast<double>(size_)) {
+                    failures = failures_;
+                    opened = true;
+
+                    state_ = state::open;
+                    open_until_ = now + limits.cooldown;
+                    size_ = 0;
+                    failures_ = 0;
+                    next_ = 0;
+                }
+            }
+        }
+
+        if (opened)
+            spdlog::get("logger")->warn(
+                "⚠️ circuit of {} opened: {} of the last {} calls failed",
+                upstream_name(upstream), failures, limits.window);
+        if (closed)
+            spdlog::get("logger")->info("ℹ️ circuit of {} closed",
+                                        upstream_name(upstream));
+    }
+
+  private:
+    enum class state : std::uint8_t { closed, open, half_open };
+
+    std::mutex mutex_;
+    state state_ = state::closed;
+    clock::time_point open_until_;
+    clock::time_point probe_sent_;
+    // The outcomes of the last calls while closed, true for a failure.
+    std::vector<bool> outcomes_;
+    std::size_t next_ = 0;
+    std::size_t size_ = 0;
+    std::size_t failures_ = 0;
+};
+
+circuit_breaker breakers[upstream_count];
+
+// A guarded call, shared by its copies and its timers.
+struct guarded_call {
+    explicit guarded_call(pplx::cancellation_token token)
+        : caller(token),
+          source(pplx::cancellation_token_source::create_linked_source(token)) {
+    }
+
+    const pplx::cancellation_token caller;
+    // Canceled by the caller, at the deadline, or once a copy has won.
+    pplx::cancellation_token_source source;
+    pplx::task_completion_event<web::http::http_response> done;
+    clock::time_point start;
+
+    // Guards everything below.
+    std::mutex mutex;
+    std::size_t running = 0;
+    bool finished = false;
+    bool expired = false;
+};
+
+void finish(const std::shared_ptr<guarded_call> &call, upstream upstream,
+            web::http::http_response response, std::exception_ptr error,
+            bool failed, bool expired) {
+    const auto now = clock::now();
+    auto &breaker = breakers[static_cast<std::size_t>(upstream)];
+
+    if (expired) {
+        // pooled_request() leaves canceled calls out of the metrics.
+        record_upstream(upstream, now - call->start, true);
+        breaker.record(upstream, true, now);
+
+        call->done.set_exception(std::make_exception_ptr(upstream_error(
+            std::string(upstream_name(upstream)) + ": deadline of " +
+            std::to_string(
+                upstream_policies[static_cast<std::size_t>(upstream)]
+                    .deadline.count()) +
+            " ms exceeded")));
+    } else {
+        if (!call->caller.is_canceled())
+            breaker.record(upstream, failed, now);
+
+        if (error)
+            call->done.set_exception(error);
+        else
+            call->done.set(response);
+    }
+
+    // Stops the copy that lost, if any.
+    call->source.cancel();
+}
+
+void attempt(const std::shared_ptr<guarded_call> &call, upstream upstream,
+             const std::string &base_uri, web::http::http_request request) {
+    {
+        std::lock_guard<std::mutex> guard(call->mutex);
+        if (call->finished)
+            return;
+
+        ++call->running;
+    }
+
+    pooled_request(upstream, base_uri, std::move(request),
+                   call->source.get_token())
+        .then([call, upstream](pplx::task<web::http::http_response> task) {
+            web::http::http_response response;
+            std::exception_ptr error;
+
+            try {
+                response = task.get();
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            const bool failed = error || response.status_code() < 200 ||
+                                response.status_code() >= 300;
+            bool expired;
+
+            {
+                std::lock_guard<std::mutex> guard(call->mutex);
+                --call->running;
+
+                // The other copy may still succeed.
+                if (call->finished || (failed && call->running != 0))
+                    return;
+
+                call->finished = true;
+                expired = call->expired;
+            }
+
+            finish(call, upstream, std::move(response), error, failed,
+                   expired);
+        });
+}
+}
+
+pplx::task<web::http::http_response>
+guarded_request(upstream upstream, const std::string &base_uri,
+                web::http::http_request request,
+                pplx::cancellation_token token) {
+    const std::size_t index = static_cast<std::size_t>(upstream);
+    const upstream_policy &policy = upstream_policies[index];
+    const auto now = clock::now();
+
+    if (!breakers[index].allow(now)) {
+        rejected.fetch_add(1, std::memory_order_relaxed);
+
+        return pplx::task_from_exception<web::http::http_response>(
+            upstream_error(std::string(upstream_name(upstream)) +
+                           ": circuit open"));
+    }
+
+    auto call = std::make_shared<guarded_call>(token);
+    call->start = now;
+
+    if (policy.deadline.count() != 0)
+        timers().schedule(now + policy.deadline, [call] {
+            {
+                std::lock_guard<std::mutex> guard(call->mutex);
+                if (call->finished)
+                    return;
+
+                call->expired = true;
+            }
+
+            call->source.cancel();
+        });
+
+    const auto p95 = upstream_quantile(upstream, 0.95, hedge_min_samples);
+    const clock::duration delay =
+        std::max<clock::duration>(p95, hedge_min_delay);
+
+    if (policy.hedge && request.method() == web::http::methods::GET &&
+        p95.count() != 0 &&
+        (policy.deadline.count() == 0 || delay < policy.deadline)) {
+        // A request can only be sent once; a GET has no body to copy.
+        web::http::http_request copy(request.method());
+        copy.set_request_uri(request.request_uri());
+        copy.headers() = request.headers();
+
+        timers().schedule(now + delay, [call, upstream, base_uri, copy] {
+            {
+                std::lock_guard<std::mutex> guard(call->mutex);
+                if (call->finished)
+                    return;
+            }
+
+            hedged.fetch_add(1, std::memory_order_relaxed);
+
+            attempt(call, upstream, base_uri, copy);
+        });
+    }
+
+    attempt(call, upstream, base_uri, std::move(request));
+
+    return pplx::create_task(call->done);
+}
+
+std::uint64_t hedged_requests() {
+    return hedged.load(std::memory_order_relaxed);
+}
+
+std::uint64_t rejected_requests() {
+    return rejected.load(std::memory_order_relaxed);
+}
+}
@@ -0,0 +1,95 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#include "utf16_cursor.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace ohmyarch {
+// Number of leading ASCII bytes in [begin, begin + size), checked 16 or 8
+// bytes at a time. Stops at the first block that holds a non-ASCII byte.
+static std::size_t ascii_prefix(const char *begin, std::size_t size) {
+    std::size_t count = 0;
+
+#ifdef __SSE2__
+    while (size - count >= 16) {
+        const __m128i block = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(begin + count));
+        if (_mm_movemask_epi8(block) != 0)
+            return count;
+
+        count += 16;
+    }
+#endif
+
+    while (size - count >= 8) {
+        std::uint64_t block;
+        std::memcpy(&block, begin + count, 8);
+        if ((block & 0x8080808080808080ull) != 0)
+            return count;
+
+        count += 8;
+    }
+
+    return count;
+}
+
+utf16_cursor::position utf16_cursor::advance(position from,
+                                             std::int64_t unit) const {
+    const char *data = text_.data();
+    const std::size_t size = text_.size();
+
+    while (from.unit < unit && from.byte < size) {
+        // One UTF-8 byte per UTF-16 unit for ASCII, so a whole run can be
+        // skipped as long as it doesn't overshoot.
+        const std::size_t wanted =
+            static_cast<std::size_t>(unit - from.unit);
+        const std::size_t run = ascii_prefix(
+            data + from.byte, std::min(wanted, size - from.byte));
+        if (run != 0) {
+            from.byte += run;
+            from.unit += run;
+
+            continue;
+        }
+
+        const unsigned char lead = data[from.byte];
+
+        std::size_t bytes = 1;
+        std::int64_t units = 1;
+
+        if (lead >= 0xf0) {
+            bytes = 4;
+            units = 2; // a surrogate pair
+        } else if (lead >= 0xe0) {
+            bytes = 3;
+        } else if (lead >= 0xc0) {
+            bytes = 2;
+        }
+
+        from.byte = std::min(from.byte + bytes, size);
+        from.unit += units;
+    }
+
+    return from;
+}
+
+boost::string_view utf16_cursor::slice(std::int32_t offset,
+                                       std::int32_t length) {
+    if (offset < position_.unit)
+        position_ = {0, 0};
+
+    position_ = advance(position_, offset);
+
+    const position end = advance(position_, std::int64_t(offset) + length);
+
+    return text_.substr(position_.byte, end.byte - position_.byte);
+}
+}
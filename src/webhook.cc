@@ -0,0 +1,102 @@
+//
+// Copyright (C) Michael Yang. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full
+// license information.
+//
+
+#include "webhook.h"
+#include <boost/asio/ssl.hpp>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+
+namespace ohmyarch {
+static web::http::experimental::listener::http_listener_config
+listener_config(const webhook::options &options) {
+    web::http::experimental::listener::http_listener_config config;
+
+    if (options.certificate.empty())
+        return config;
+
+    const std::string certificate = options.certificate;
+    const std::string private_key = options.private_key;
+
+    config.set_ssl_context_callback(
+        [certificate, private_key](boost::asio::ssl::context &context) {
+            context.set_options(boost::asio::ssl::context::default_workarounds |
+                                boost::asio::ssl::context::no_sslv2 |
+                                boost::asio::ssl::context::no_sslv3 |
+                                boost::asio::ssl::context::no_tlsv1 |
+                                boost::asio::ssl::context::no_tlsv1_1);
+            context.use_certificate_chain_file(certificate);
+            context.use_private_key_file(private_key,
+                                         boost::asio::ssl::context::pem);
+        });
+
+    return config;
+}
+
+// Takes as long for every wrong token of the right length, so the token
+// can't be guessed a byte at a time.
+static bool same_token(const std::string &a, const std::string &b) {
+    if (a.size() != b.size())
+        return false;
+
+    unsigned char difference = 0;
+    for (std::size_t i = 0; i < a.size(); ++i)
+        difference |= static_cast<unsigned char>(a[i] ^ b[i]);
+
+    return difference == 0;
+}
+
+webhook::webhook(const options &options, handler handler)
+    : secret_token_(options.secret_token), handler_(std::move(handler)),
+      listener_(options.listen_uri, listener_config(options)) {
+    // Anyone could post updates otherwise.
+    if (secret_token_.empty())
+        throw std::invalid_argument("no secret token");
+
+    listener_.support(web::http::methods::POST,
+                      [this](web::http::http_request request) {
+                          receive(std::move(request));
+                      });
+
+    listener_.open().wait();
+}
+
+webhook::~webhook() {
+    try {
+        listener_.close().wait();
+    } catch (const std::exception &error) {
+        spdlog::get("logger")->error("❌ webhook: {}", error.what());
+    }
+}
+
+void webhook::receive(web::http::http_request request) {
+    const auto &headers = request.headers();
+    const auto token = headers.find("X-Telegram-Bot-Api-Secret-Token");
+    if (token == headers.end() || !same_token(token->second, secret_token_)) {
+        spdlog::get("logger")->warn("⚠️ webhook: bad secret token from {}",
+                                    request.remote_address());
+
+        request.reply(web::http::status_codes::Unauthorized);
+
+        return;
+    }
+
+    request.extract_string(true).then(
+        [this, request](pplx::task<std::string> body) {
+            // Telegram would resend the update if it weren't acknowledged,
+            // and a body that didn't arrive or doesn't parse won't get
+            // better.
+            request.reply(web::http::status_codes::OK);
+
+            try {
+                const auto updates = parse_update(body.get());
+                if (updates)
+                    handler_(updates.value());
+            } catch (const std::exception &error) {
+                spdlog::get("logger")->error("❌ webhook: {}", error.what());
+            }
+        });
+}
+}